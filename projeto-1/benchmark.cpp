@@ -0,0 +1,320 @@
+// Benchmark e conferência do projeto 1.
+//
+// Gera arquivos .dat sintéticos (distribuição normal ou uniforme) de 10^3 a
+// 10^9 valores e mede, para cada um, as fases de leitura (le_arquivo),
+// momentos (AcumuladorMomentos) e histogramas (AcumuladorHistogramas),
+// em MB/s e valores/s. Antes das medidas confere a saída do programa com
+// todos os arquivos exemplos/testN_B.out, em todos os modos.
+//
+// Compilação: g++ -std=c++17 -O2 -pthread benchmark.cpp -o benchmark
+
+#include <chrono>     // Para std::chrono::steady_clock
+#include <iomanip>    // Para std::setw, std::setprecision
+#include <random>     // Para std::mt19937_64, std::normal_distribution
+#include <sstream>    // Para std::ostringstream
+
+#define PROJETO1_SEM_MAIN
+#include "projeto-1.cpp"
+
+//=====================================================================
+//
+// Prototipo das funções usadas no main
+//
+//=====================================================================
+
+// Opções do benchmark.
+struct OpcoesBenchmark {
+    // expoentes do menor e do maior arquivo (10^min a 10^max valores)
+    int min_expoente{3};
+    int max_expoente{7};
+    // distribuições geradas: "normal", "uniforme" ou as duas
+    std::vector<std::string> distribuicoes{"normal", "uniforme"};
+    // diretório dos arquivos gerados (vazio: diretório temporário do sistema)
+    std::string diretorio;
+    // diretório com os testN.dat e testN_B.out
+    std::string exemplos{"exemplos"};
+    int n_threads{1};
+    // cada fase é repetida e o menor tempo é mostrado
+    int repeticoes{3};
+    // números de caixas dos histogramas medidos
+    std::vector<int> caixas{10, 20, 50};
+    // só confere os exemplos, sem medir
+    bool so_exemplos{false};
+};
+
+// Função que mostra como executar o benchmark.
+void uso_benchmark(const std::string &nome_programa);
+
+// Função que confere a saída de cada testN_B.out do diretório nos modos
+// normal, --stream e --threads. Retorna o número de saídas diferentes.
+int confere_exemplos(const std::string &diretorio);
+
+// Função que gera o arquivo com n valores da distribuição, se ele ainda não
+// existir. Os valores vêm de um gerador com semente fixa, então o mesmo
+// arquivo é sempre gerado igual e pode ser reusado.
+void gera_arquivo(const std::filesystem::path &caminho, const std::string &distribuicao,
+                  std::uint64_t n);
+
+// Função que executa tarefa o número de vezes pedido e retorna o menor
+// tempo, em segundos.
+double mede(int repeticoes, const std::function<void()> &tarefa);
+
+// Função que mostra uma linha da tabela de resultados.
+void mostra_fase(const std::string &arquivo, const std::string &fase, double segundos,
+                 double bytes, std::uint64_t n);
+
+// Função que mede as três fases de um arquivo.
+void mede_arquivo(const std::filesystem::path &caminho, const OpcoesBenchmark &opcoes);
+
+//=====================================================================
+//
+// Programa principal
+//
+//=====================================================================
+
+int main(int argc, char const *argv[]) {
+    OpcoesBenchmark opcoes;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--min" && i + 1 < argc) {
+            if (!le_inteiro(argv[++i], opcoes.min_expoente)) {
+                uso_benchmark(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--max" && i + 1 < argc) {
+            if (!le_inteiro(argv[++i], opcoes.max_expoente)) {
+                uso_benchmark(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--dist" && i + 1 < argc) {
+            std::string distribuicao = argv[++i];
+            if (distribuicao != "normal" && distribuicao != "uniforme") {
+                uso_benchmark(argv[0]);
+                return 1;
+            }
+            opcoes.distribuicoes = {distribuicao};
+        } else if (arg == "--dir" && i + 1 < argc) {
+            opcoes.diretorio = argv[++i];
+        } else if (arg == "--exemplos" && i + 1 < argc) {
+            opcoes.exemplos = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!le_inteiro(argv[++i], opcoes.n_threads)) {
+                uso_benchmark(argv[0]);
+                return 1;
+            }
+            if (opcoes.n_threads <= 0) {
+                opcoes.n_threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        } else if (arg == "--reps" && i + 1 < argc) {
+            if (!le_inteiro(argv[++i], opcoes.repeticoes)) {
+                uso_benchmark(argv[0]);
+                return 1;
+            }
+            opcoes.repeticoes = std::max(1, opcoes.repeticoes);
+        } else if (arg == "--caixas" && i + 1 < argc) {
+            opcoes.caixas = le_caixas(argv[++i]);
+        } else if (arg == "--so-exemplos") {
+            opcoes.so_exemplos = true;
+        } else {
+            uso_benchmark(argv[0]);
+            return 1;
+        }
+    }
+    if (opcoes.min_expoente < 3 || opcoes.max_expoente > 9 ||
+        opcoes.min_expoente > opcoes.max_expoente || opcoes.caixas.empty()) {
+        uso_benchmark(argv[0]);
+        return 1;
+    }
+
+    // primeiro a conferência: medir uma versão errada não serve
+    int diferentes = confere_exemplos(opcoes.exemplos);
+    if (diferentes > 0) {
+        std::cerr << diferentes << " saída(s) diferente(s) dos exemplos" << std::endl;
+        return 4;
+    }
+    if (opcoes.so_exemplos) { return 0; }
+
+    namespace fs = std::filesystem;
+    fs::path diretorio = opcoes.diretorio.empty() ? fs::temp_directory_path() / "projeto1-bench"
+                                                  : fs::path(opcoes.diretorio);
+    fs::create_directories(diretorio);
+
+    std::cout << "\n" << std::left << std::setw(28) << "arquivo" << std::setw(12) << "fase"
+              << std::right << std::setw(12) << "segundos" << std::setw(12) << "MB/s"
+              << std::setw(14) << "valores/s" << "\n";
+    try {
+        for (auto &distribuicao : opcoes.distribuicoes) {
+            std::uint64_t n = 1;
+            for (int e = 0; e < opcoes.min_expoente; e++) { n *= 10; }
+            for (int e = opcoes.min_expoente; e <= opcoes.max_expoente; e++, n *= 10) {
+                auto caminho = diretorio / (distribuicao + "_1e" + std::to_string(e) + ".dat");
+                gera_arquivo(caminho, distribuicao, n);
+                mede_arquivo(caminho, opcoes);
+            }
+        }
+    } catch (const ErroLeitura &erro) {
+        std::cerr << erro.mensagem << std::endl;
+        return erro.codigo;
+    }
+    return 0;
+}
+
+//=====================================================================
+//
+// Funções auxiliares
+//
+//=====================================================================
+
+void uso_benchmark(const std::string &nome_programa) {
+    std::cerr << "Uso: " << nome_programa << " [opções]\n"
+              << "  --min E         menor arquivo com 10^E valores (padrão 3)\n"
+              << "  --max E         maior arquivo com 10^E valores (padrão 7, até 9)\n"
+              << "  --dist D        só a distribuição D (normal ou uniforme)\n"
+              << "  --dir DIR       diretório dos arquivos gerados\n"
+              << "  --exemplos DIR  diretório dos testN.dat e testN_B.out (padrão exemplos)\n"
+              << "  --threads N     usa N threads (0 = todos os núcleos)\n"
+              << "  --reps R        repetições de cada fase; mostra a mais rápida (padrão 3)\n"
+              << "  --caixas LISTA  números de caixas dos histogramas (padrão 10,20,50)\n"
+              << "  --so-exemplos   só confere os exemplos\n"
+              << "Sai com 4 se alguma saída for diferente dos exemplos.\n";
+}
+
+// Função confere_exemplos: o nome testN_B.out dá o arquivo testN.dat e o
+// número de caixas B. A saída é gerada em memória por mostra_resultado,
+// exatamente como o programa a escreveria.
+int confere_exemplos(const std::string &diretorio) {
+    namespace fs = std::filesystem;
+    std::error_code erro;
+    std::vector<fs::path> saidas;
+    for (auto &entrada : fs::directory_iterator(diretorio, erro)) {
+        if (entrada.path().extension() == ".out") { saidas.push_back(entrada.path()); }
+    }
+    std::sort(saidas.begin(), saidas.end());
+    if (erro || saidas.empty()) {
+        std::cerr << "Nenhum .out em " << diretorio << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, Opcoes>> modos(3);
+    modos[0].first = "normal";
+    modos[1].first = "--stream";
+    modos[1].second.streaming = true;
+    modos[2].first = "--threads 4";
+    modos[2].second.n_threads = 4;
+
+    int diferentes = 0;
+    for (auto &saida : saidas) {
+        auto nome = saida.stem().string();
+        auto separador = nome.rfind('_');
+        auto caixas = le_caixas(separador == std::string::npos ? "" : nome.substr(separador + 1));
+        if (caixas.size() != 1) { continue; }
+        auto dados = saida.parent_path() / (nome.substr(0, separador) + ".dat");
+
+        std::ifstream arquivo(saida, std::ios::binary);
+        std::ostringstream esperado;
+        esperado << arquivo.rdbuf();
+
+        for (auto &[modo, opcoes] : modos) {
+            bool igual = false;
+            try {
+                auto resultado = calcula_arquivo(dados.string(), caixas, opcoes);
+                std::ostringstream obtido;
+                mostra_resultado(obtido, resultado, resultado.histogramas[0]);
+                igual = obtido.str() == esperado.str();
+            } catch (const ErroLeitura &erro) {
+                std::cerr << erro.mensagem << std::endl;
+            }
+            std::cout << (igual ? "OK      " : "FALHOU  ") << saida.filename().string()
+                      << " (" << modo << ")\n";
+            if (!igual) { diferentes++; }
+        }
+    }
+    return diferentes;
+}
+
+void gera_arquivo(const std::filesystem::path &caminho, const std::string &distribuicao,
+                  std::uint64_t n) {
+    std::error_code erro;
+    if (std::filesystem::exists(caminho, erro)) { return; }
+
+    // escreve num temporário para que um arquivo incompleto não seja reusado
+    auto temporario = caminho;
+    temporario += ".tmp";
+    std::ofstream arquivo(temporario, std::ios::binary);
+    if (!arquivo) { throw ErroLeitura{"Erro ao criar " + temporario.string(), 2}; }
+
+    std::mt19937_64 gerador(n);
+    std::normal_distribution<double> normal(10.0, 2.0);
+    std::uniform_real_distribution<double> uniforme(0.0, 20.0);
+    bool eh_normal = distribuicao == "normal";
+
+    std::vector<char> buffer(1 << 20);
+    std::size_t usado = 0;
+    for (std::uint64_t i = 0; i < n; i++) {
+        if (usado + 32 > buffer.size()) {
+            arquivo.write(buffer.data(), static_cast<std::streamsize>(usado));
+            usado = 0;
+        }
+        double valor = eh_normal ? normal(gerador) : uniforme(gerador);
+        // 4 casas decimais, como nos exemplos
+        auto fim = std::to_chars(buffer.data() + usado, buffer.data() + usado + 31, valor,
+                                 std::chars_format::fixed, 4).ptr;
+        *fim = '\n';
+        usado = fim + 1 - buffer.data();
+    }
+    arquivo.write(buffer.data(), static_cast<std::streamsize>(usado));
+    arquivo.close();
+    if (!arquivo) { throw ErroLeitura{"Erro ao escrever " + temporario.string(), 2}; }
+    std::filesystem::rename(temporario, caminho);
+}
+
+double mede(int repeticoes, const std::function<void()> &tarefa) {
+    double melhor = std::numeric_limits<double>::infinity();
+    for (int r = 0; r < repeticoes; r++) {
+        auto inicio = std::chrono::steady_clock::now();
+        tarefa();
+        std::chrono::duration<double> duracao = std::chrono::steady_clock::now() - inicio;
+        melhor = std::min(melhor, duracao.count());
+    }
+    return melhor;
+}
+
+void mostra_fase(const std::string &arquivo, const std::string &fase, double segundos,
+                 double bytes, std::uint64_t n) {
+    std::cout << std::left << std::setw(28) << arquivo << std::setw(12) << fase << std::right
+              << std::fixed << std::setprecision(4) << std::setw(12) << segundos
+              << std::setprecision(1) << std::setw(12) << bytes / 1e6 / segundos
+              << std::scientific << std::setprecision(3) << std::setw(14) << n / segundos
+              << std::defaultfloat << std::endl;
+}
+
+// Função mede_arquivo: a leitura é medida em bytes de texto; momentos e
+// histogramas em bytes de double (8 por valor), que é o que eles percorrem.
+void mede_arquivo(const std::filesystem::path &caminho, const OpcoesBenchmark &opcoes) {
+    auto nome = caminho.filename().string();
+    double bytes_texto = static_cast<double>(std::filesystem::file_size(caminho));
+
+    std::vector<double> valores;
+    auto segundos = mede(opcoes.repeticoes, [&] {
+        valores = le_arquivo(caminho.string(), opcoes.n_threads);
+    });
+    std::uint64_t n = valores.size();
+    double bytes_valores = 8.0 * n;
+    mostra_fase(nome, "leitura", segundos, bytes_texto, n);
+
+    Momentos momentos;
+    segundos = mede(opcoes.repeticoes, [&] {
+        AcumuladorMomentos acumulador(false, opcoes.n_threads);
+        acumulador.push(valores);
+        momentos = acumulador.result();
+    });
+    mostra_fase(nome, "momentos", segundos, bytes_valores, n);
+
+    std::vector<Histograma> histogramas;
+    segundos = mede(opcoes.repeticoes, [&] {
+        AcumuladorHistogramas acumulador(momentos, opcoes.caixas, opcoes.n_threads);
+        acumulador.push(valores);
+        histogramas = acumulador.result();
+    });
+    mostra_fase(nome, "histogramas", segundos, bytes_valores, n);
+}
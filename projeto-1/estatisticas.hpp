@@ -0,0 +1,1070 @@
+// Biblioteca de estatísticas do projeto 1, para ser usada sem o executável:
+// basta incluir este arquivo. Os valores são passados em fatias a dois
+// acumuladores, um para os momentos e outro para os histogramas, que não
+// copiam as fatias e podem ser juntados (merge) quando partes dos dados são
+// processadas separadamente. Os valores têm que ser finitos; inf e nan
+// não têm caixa no histograma:
+//
+//     AcumuladorMomentos momentos;
+//     momentos.push(valores);
+//     AcumuladorHistogramas histogramas(momentos.result(), {10, 20});
+//     histogramas.push(valores);
+//     auto resultado = histogramas.result();
+//
+// O programa projeto-1.cpp só lê os arquivos e escreve as saídas com ela.
+
+#ifndef PROJETO1_ESTATISTICAS_HPP
+#define PROJETO1_ESTATISTICAS_HPP
+
+#include <algorithm>  // Para std::min, std::sort, std::nth_element
+#include <atomic>     // Para std::atomic
+#include <cmath>      // Para std::sqrt, std::ceil
+#include <cstdint>    // Para std::uint64_t
+#include <functional> // Para std::function
+#include <limits>     // Para std::numeric_limits
+#include <thread>     // Para std::thread
+#include <utility>    // Para std::pair
+#include <vector>     // Para std::vector
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>       // Para std::span
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PROJETO1_X86
+#include <immintrin.h> // Para as instruções SSE2 e AVX2
+#endif
+
+//=====================================================================
+//
+// Interface
+//
+//=====================================================================
+
+// Fatia de valores passada aos acumuladores, sem cópia: std::span<const
+// double> no C++20; antes dele, uma versão mínima com o mesmo uso.
+#if __cplusplus >= 202002L && __has_include(<span>)
+using FatiaValores = std::span<const double>;
+#else
+class FatiaValores {
+    const double *_dados{nullptr};
+    std::size_t _tamanho{0};
+
+public:
+    FatiaValores() = default;
+    FatiaValores(const double *dados, std::size_t tamanho) : _dados(dados), _tamanho(tamanho) {}
+    FatiaValores(const std::vector<double> &valores)
+        : _dados(valores.data()), _tamanho(valores.size()) {}
+
+    const double *data() const { return _dados; }
+    std::size_t size() const { return _tamanho; }
+    const double *begin() const { return _dados; }
+    const double *end() const { return _dados + _tamanho; }
+};
+#endif
+
+// Estrutura que acumula contagem, média, desvio, mínimo e máximo em uma
+// única passada (algoritmo de Welford). Momentos de partes diferentes dos
+// dados podem ser combinados.
+struct Momentos {
+    std::size_t n{0};
+    double media{0};
+    // soma de (valor - media)^2
+    double m2{0};
+    double xmin{std::numeric_limits<double>::infinity()};
+    double xmax{-std::numeric_limits<double>::infinity()};
+
+    void adiciona(double valor) {
+        n++;
+        double delta = valor - media;
+        media += delta / n;
+        m2 += delta * (valor - media);
+        if (valor < xmin) { xmin = valor; }
+        if (valor > xmax) { xmax = valor; }
+    }
+
+    // junta os momentos de outro conjunto de valores (fórmula de Chan),
+    // como se os valores de outro viessem depois dos deste.
+    void combina(const Momentos &outro) {
+        if (outro.n == 0) { return; }
+        if (n == 0) { *this = outro; return; }
+        double total = static_cast<double>(n + outro.n);
+        double delta = outro.media - media;
+        media += delta * (outro.n / total);
+        m2 += outro.m2 + delta * delta * (n * (outro.n / total));
+        n += outro.n;
+        if (outro.xmin < xmin) { xmin = outro.xmin; }
+        if (outro.xmax > xmax) { xmax = outro.xmax; }
+    }
+
+    // desvio padrão amostral
+    double desvio() const { return std::sqrt(m2 / (n - 1)); }
+};
+
+// Classe EsbocoQuantis: esboço KLL (Karnin, Lang e Liberty) para quantis
+// aproximados. Guarda no máximo uns 3k valores, organizados em níveis: um
+// valor no nível h representa 2^h valores da entrada. Quando os níveis
+// enchem, o nível mais baixo cheio é ordenado e metade dos seus valores
+// (os de posição par ou os de posição ímpar) sobe para o nível seguinte.
+// Com k = 400 o erro de posição de um quantil é de ~0,7% de n com 99% de
+// confiança, usando ~10 KB. A escolha par/ímpar vem de um gerador com
+// semente fixa, então o mesmo esboço é obtido com as mesmas operações na
+// mesma ordem. Esboços de partes dos dados podem ser combinados.
+class EsbocoQuantis {
+    static constexpr std::size_t k = 400;
+    std::vector<std::vector<double>> _niveis;
+    // capacidade de cada nível e a soma delas; mudam quando um nível é criado
+    std::vector<std::size_t> _capacidades;
+    std::size_t _capacidade_total{0};
+    // valores adicionados e valores guardados
+    std::uint64_t _n{0};
+    std::size_t _guardados{0};
+    // estado do gerador xorshift64
+    std::uint64_t _estado{0x9e3779b97f4a7c15ULL};
+
+    // cria níveis até ter n_niveis e recalcula as capacidades
+    void cria_niveis(std::size_t n_niveis);
+    // compacta o nível mais baixo que estiver cheio
+    void comprime();
+
+public:
+    void adiciona(double valor);
+    void combina(const EsbocoQuantis &outro);
+    std::uint64_t n() const { return _n; }
+    // valor aproximado do quantil q (entre 0 e 1)
+    double quantil(double q) const;
+};
+
+
+// Quantidade de valores em cada bloco do cálculo dos momentos. Os momentos
+// de cada bloco são combinados sempre na ordem dos blocos, então o resultado
+// é o mesmo com qualquer número de threads.
+constexpr std::size_t valores_por_bloco = 1 << 16;
+
+// Função que calcula os momentos de um bloco de n valores com os kernels
+// vetoriais (soma compensada e soma dos quadrados dos desvios).
+Momentos momentos_bloco(const double *valores, std::size_t n);
+
+// Função que monta o esboço de quantis de um bloco de n valores.
+EsbocoQuantis esboco_bloco(const double *valores, std::size_t n);
+
+// Contagem de uma caixa: 64 bits, porque uma caixa pode passar de 2^31
+// valores.
+using Contagem = std::int64_t;
+
+// Função que soma em contagem as caixas dos n valores, que têm que estar
+// entre xmin e xmax. Usa o kernel vetorial de divisão por multiplicação.
+void conta_bloco(const double *valores, std::size_t n, double xmin, double xmax, int B,
+                 Contagem *contagem);
+
+// Função que executa tarefa(thread, i) para i de 0 a n_tarefas-1 usando
+// n_threads threads. Cada thread pega a próxima tarefa livre.
+void executa_em_paralelo(std::size_t n_tarefas, int n_threads,
+                         const std::function<void(int, std::size_t)> &tarefa);
+
+// Função que calcula os momentos do vetor em paralelo, por blocos.
+Momentos calcula_momentos(const std::vector<double> &valores, int n_threads);
+
+// Função que calcula os momentos dos n valores em paralelo, por blocos. Se
+// esboco não for nulo, também monta nele o esboço de quantis dos valores.
+Momentos calcula_momentos(const double *valores, std::size_t n, int n_threads,
+                          EsbocoQuantis *esboco = nullptr);
+
+// Função que conta os valores em cada uma das B caixas entre xmin e xmax,
+// com um vetor de contagem por thread.
+std::vector<Contagem> conta_caixas(const std::vector<double> &valores, double xmin, double xmax,
+                                   int B, int n_threads);
+
+// Função que conta as caixas de vários histogramas, um para cada número de
+// caixas em caixas, numa única passada pelos n valores.
+std::vector<std::vector<Contagem>> conta_caixas(const double *valores, std::size_t n, double xmin,
+                                                double xmax, const std::vector<int> &caixas,
+                                                int n_threads);
+
+// Caixa não vazia de um histograma esparso: índice e contagem.
+using CaixaEsparsa = std::pair<int, Contagem>;
+
+// Histograma: limites (B+1) e contagem (B) das caixas.
+// No histograma esparso vetinfo e vetcont ficam vazios: só as caixas não
+// vazias são guardadas, em ordem de índice, e os limites são calculados na
+// hora como xmin + i*delta, igual a monta_vetor_informacao.
+struct Histograma {
+    std::vector<double> vetinfo;
+    std::vector<Contagem> vetcont;
+    int B{0};
+    double xmin{0}, xmax{0};
+    std::vector<CaixaEsparsa> esparso;
+
+    Histograma() = default;
+    // histograma denso
+    Histograma(std::vector<double> vetinfo, std::vector<Contagem> vetcont)
+        : vetinfo(std::move(vetinfo)), vetcont(std::move(vetcont)) {}
+    // histograma esparso
+    Histograma(double xmin, double xmax, int B, std::vector<CaixaEsparsa> esparso = {})
+        : B(B), xmin(xmin), xmax(xmax), esparso(std::move(esparso)) {}
+
+    bool eh_esparso() const { return B > 0; }
+    int n_caixas() const { return eh_esparso() ? B : static_cast<int>(vetcont.size()); }
+};
+
+// Função que diz se o histograma de B caixas para n valores deve ser
+// esparso: com mais caixas que valores, a maioria das caixas fica vazia.
+bool usa_esparso(int B, std::size_t n);
+
+// Função que conta as caixas não vazias dos n valores, em ordem de índice.
+std::vector<CaixaEsparsa> conta_bloco_esparso(const double *valores, std::size_t n,
+                                              double xmin, double xmax, int B);
+
+// Função que junta listas de caixas não vazias, somando as contagens.
+std::vector<CaixaEsparsa> junta_esparsos(std::vector<std::vector<CaixaEsparsa>> listas,
+                                         int n_threads);
+
+
+// Função que retorna os B+1 limites das caixas entre xmin e xmax.
+std::vector<double> monta_vetor_informacao(double xmin, double xmax, int B);
+
+// Função que limita o quociente (valor-xmin)/delta a [0, B-1].
+double limita_quociente(double q, int B);
+
+// Função que retorna a caixa (0 a B-1) onde o valor é contado.
+int indice_caixa(double valor, double xmin, double xmax, double delta, int B);
+
+
+// Função que calcula os percentis exatos (0 a 100) dos n valores, com
+// interpolação linear entre posições vizinhas. Reordena os valores no lugar.
+std::vector<double> calcula_percentis(double *valores, std::size_t n,
+                                      const std::vector<double> &percentis, int n_threads);
+
+
+// Classe AcumuladorMomentos: primeira passada. Recebe os valores em fatias
+// (push), junta o acumulador de outra parte dos dados (merge) e dá a
+// contagem, média, desvio, mínimo e máximo (result) e, se pedido, o esboço
+// de quantis (esboco). Os momentos são calculados em blocos de
+// valores_por_bloco valores combinados em ordem, então o resultado não
+// depende do tamanho das fatias nem do número de threads.
+class AcumuladorMomentos {
+    bool _com_esboco;
+    int _n_threads;
+    Momentos _total;
+    EsbocoQuantis _esboco;
+    // valores do último bloco, ainda incompleto
+    std::vector<double> _pendente;
+
+    // calcula e combina os blocos dos n valores (o último pode ser curto)
+    void processa_blocos(const double *valores, std::size_t n);
+
+public:
+    explicit AcumuladorMomentos(bool quantis = false, int n_threads = 1);
+    void push(FatiaValores valores);
+    void merge(const AcumuladorMomentos &outro);
+    Momentos result() const;
+    EsbocoQuantis esboco() const;
+};
+
+// Classe AcumuladorHistogramas: segunda passada. As caixas dependem do
+// mínimo e do máximo, então ela é criada com o resultado de um
+// AcumuladorMomentos e recebe os mesmos valores de novo. Cada número de
+// caixas vira um histograma denso ou esparso (usa_esparso). Os valores não
+// são copiados.
+class AcumuladorHistogramas {
+    // listas esparsas guardadas antes de serem juntadas numa só
+    static constexpr std::size_t listas_guardadas = 64;
+    double _xmin, _xmax;
+    int _n_threads;
+    std::vector<Histograma> _histogramas;
+    // números de caixas dos histogramas densos e dos esparsos
+    std::vector<int> _densas, _esparsos;
+    // listas de caixas não vazias ainda não juntadas, por histograma
+    std::vector<std::vector<std::vector<CaixaEsparsa>>> _listas;
+
+public:
+    AcumuladorHistogramas(const Momentos &momentos, const std::vector<int> &caixas,
+                          int n_threads = 1);
+    void push(FatiaValores valores);
+    void merge(const AcumuladorHistogramas &outro);
+    std::vector<Histograma> result() const;
+};
+
+//=====================================================================
+//
+// Acumuladores
+//
+//=====================================================================
+
+inline AcumuladorMomentos::AcumuladorMomentos(bool quantis, int n_threads)
+    : _com_esboco(quantis), _n_threads(std::max(1, n_threads)) {}
+
+// Os blocos completos da fatia são calculados direto nela, em ondas de
+// blocos_por_onda blocos em paralelo, e combinados na ordem dos blocos. Com
+// o esboço, só há blocos_por_onda esboços na memória de cada vez.
+inline void AcumuladorMomentos::processa_blocos(const double *valores, std::size_t n) {
+    constexpr std::size_t blocos_por_onda = 64;
+    auto n_blocos = (n + valores_por_bloco - 1) / valores_por_bloco;
+    auto tamanho_onda = _com_esboco ? blocos_por_onda : std::max<std::size_t>(n_blocos, 1);
+    for (std::size_t onda = 0; onda < n_blocos; onda += tamanho_onda) {
+        auto n_onda = std::min(tamanho_onda, n_blocos - onda);
+        std::vector<Momentos> parciais(n_onda);
+        std::vector<EsbocoQuantis> esbocos(_com_esboco ? n_onda : 0);
+        executa_em_paralelo(n_onda, _n_threads, [&](int, std::size_t i) {
+            auto inicio = (onda + i) * valores_por_bloco;
+            auto fim = std::min(inicio + valores_por_bloco, n);
+            parciais[i] = momentos_bloco(valores + inicio, fim - inicio);
+            if (_com_esboco) { esbocos[i] = esboco_bloco(valores + inicio, fim - inicio); }
+        });
+        for (auto &m : parciais) { _total.combina(m); }
+        for (auto &e : esbocos) { _esboco.combina(e); }
+    }
+}
+
+// Função push: só os valores que não completam um bloco são copiados, para
+// que os blocos sejam os mesmos qualquer que seja o tamanho das fatias.
+inline void AcumuladorMomentos::push(FatiaValores valores) {
+    auto dados = valores.data();
+    auto n = valores.size();
+    if (!_pendente.empty()) {
+        auto falta = std::min(valores_por_bloco - _pendente.size(), n);
+        _pendente.insert(_pendente.end(), dados, dados + falta);
+        dados += falta;
+        n -= falta;
+        if (_pendente.size() < valores_por_bloco) { return; }
+        processa_blocos(_pendente.data(), _pendente.size());
+        _pendente.clear();
+    }
+    auto completos = n / valores_por_bloco * valores_por_bloco;
+    processa_blocos(dados, completos);
+    if (completos < n) {
+        // reservado uma vez: o bloco pendente nunca passa de valores_por_bloco
+        _pendente.reserve(valores_por_bloco);
+        _pendente.assign(dados + completos, dados + n);
+    }
+}
+
+// Função merge: os valores de outro vêm depois dos deste, então o bloco
+// incompleto deste é fechado como um bloco curto.
+inline void AcumuladorMomentos::merge(const AcumuladorMomentos &outro) {
+    processa_blocos(_pendente.data(), _pendente.size());
+    _pendente.clear();
+    _total.combina(outro._total);
+    if (_com_esboco) { _esboco.combina(outro._esboco); }
+    _pendente = outro._pendente;
+}
+
+inline Momentos AcumuladorMomentos::result() const {
+    Momentos total = _total;
+    total.combina(momentos_bloco(_pendente.data(), _pendente.size()));
+    return total;
+}
+
+inline EsbocoQuantis AcumuladorMomentos::esboco() const {
+    EsbocoQuantis esboco = _esboco;
+    if (_com_esboco) { esboco.combina(esboco_bloco(_pendente.data(), _pendente.size())); }
+    return esboco;
+}
+
+// Os histogramas densos já começam com as caixas zeradas e os limites; os
+// esparsos guardam as listas de caixas não vazias de cada push.
+inline AcumuladorHistogramas::AcumuladorHistogramas(const Momentos &momentos,
+                                                    const std::vector<int> &caixas,
+                                                    int n_threads)
+    : _xmin(momentos.xmin), _xmax(momentos.xmax), _n_threads(std::max(1, n_threads)),
+      _listas(caixas.size()) {
+    for (auto B : caixas) {
+        if (usa_esparso(B, momentos.n)) {
+            _histogramas.push_back(Histograma(_xmin, _xmax, B));
+            _esparsos.push_back(B);
+        } else {
+            _histogramas.push_back({monta_vetor_informacao(_xmin, _xmax, B),
+                                    std::vector<Contagem>(B, 0)});
+            _densas.push_back(B);
+        }
+    }
+}
+
+// Função push: com uma thread ou um bloco só, as caixas densas são contadas
+// direto nos histogramas; senão conta_caixas usa um vetor por thread.
+inline void AcumuladorHistogramas::push(FatiaValores valores) {
+    auto dados = valores.data();
+    auto n = valores.size();
+    if (n == 0) { return; }
+    if (_n_threads == 1 || n <= valores_por_bloco) {
+        for (auto &histograma : _histogramas) {
+            if (histograma.eh_esparso()) { continue; }
+            conta_bloco(dados, n, _xmin, _xmax, static_cast<int>(histograma.vetcont.size()),
+                        histograma.vetcont.data());
+        }
+    } else if (!_densas.empty()) {
+        auto contagens = conta_caixas(dados, n, _xmin, _xmax, _densas, _n_threads);
+        std::size_t d = 0;
+        for (auto &histograma : _histogramas) {
+            if (histograma.eh_esparso()) { continue; }
+            auto &contagem = contagens[d++];
+            for (std::size_t i = 0; i < contagem.size(); i++) {
+                histograma.vetcont[i] += contagem[i];
+            }
+        }
+    }
+    if (_esparsos.empty()) { return; }
+
+    auto n_blocos = (n + valores_por_bloco - 1) / valores_por_bloco;
+    for (std::size_t h = 0; h < _histogramas.size(); h++) {
+        if (!_histogramas[h].eh_esparso()) { continue; }
+        auto B = _histogramas[h].B;
+        auto &listas = _listas[h];
+        auto antes = listas.size();
+        listas.resize(antes + n_blocos);
+        executa_em_paralelo(n_blocos, _n_threads, [&](int, std::size_t b) {
+            auto inicio = b * valores_por_bloco;
+            auto fim = std::min(inicio + valores_por_bloco, n);
+            listas[antes + b] = conta_bloco_esparso(dados + inicio, fim - inicio, _xmin, _xmax, B);
+        });
+        // limita o número de listas guardadas entre um push e outro
+        if (listas.size() > listas_guardadas) {
+            auto junta = junta_esparsos(std::move(listas), _n_threads);
+            listas.clear();
+            listas.push_back(std::move(junta));
+        }
+    }
+}
+
+// Função merge: outro tem que ter sido criado com os mesmos momentos e
+// caixas; as contagens são inteiras, então a ordem não importa.
+inline void AcumuladorHistogramas::merge(const AcumuladorHistogramas &outro) {
+    for (std::size_t h = 0; h < _histogramas.size(); h++) {
+        auto &contagem = _histogramas[h].vetcont;
+        for (std::size_t i = 0; i < contagem.size(); i++) {
+            contagem[i] += outro._histogramas[h].vetcont[i];
+        }
+        _listas[h].insert(_listas[h].end(), outro._listas[h].begin(), outro._listas[h].end());
+    }
+}
+
+inline std::vector<Histograma> AcumuladorHistogramas::result() const {
+    auto histogramas = _histogramas;
+    for (std::size_t h = 0; h < histogramas.size(); h++) {
+        if (histogramas[h].eh_esparso()) {
+            histogramas[h].esparso = junta_esparsos(_listas[h], _n_threads);
+        }
+    }
+    return histogramas;
+}
+
+// Função executa_em_paralelo: as tarefas são distribuídas por um contador
+// atômico, então uma thread que termina antes pega mais tarefas.
+inline void executa_em_paralelo(std::size_t n_tarefas, int n_threads,
+                                const std::function<void(int, std::size_t)> &tarefa) {
+    std::atomic<std::size_t> proxima{0};
+    auto trabalha = [&](int thread) {
+        for (auto i = proxima++; i < n_tarefas; i = proxima++) {
+            tarefa(thread, i);
+        }
+    };
+    // não cria mais threads do que tarefas
+    int n = static_cast<int>(std::min<std::size_t>(std::max(n_threads, 1), n_tarefas));
+    std::vector<std::thread> threads;
+    for (int t = 1; t < n; t++) {
+        threads.emplace_back(trabalha, t);
+    }
+    // a thread principal também trabalha
+    trabalha(0);
+    for (auto &t : threads) { t.join(); }
+}
+
+// Função calcula_momentos: atalho para um AcumuladorMomentos com um push só.
+inline Momentos calcula_momentos(const std::vector<double> &valores, int n_threads) {
+    return calcula_momentos(valores.data(), valores.size(), n_threads);
+}
+
+inline Momentos calcula_momentos(const double *valores, std::size_t n, int n_threads,
+                                 EsbocoQuantis *esboco) {
+    AcumuladorMomentos acumulador(esboco != nullptr, n_threads);
+    acumulador.push(FatiaValores(valores, n));
+    if (esboco != nullptr) { *esboco = acumulador.esboco(); }
+    return acumulador.result();
+}
+
+inline std::vector<Contagem> conta_caixas(const std::vector<double> &valores, double xmin,
+                                          double xmax, int B, int n_threads) {
+    return std::move(conta_caixas(valores.data(), valores.size(), xmin, xmax,
+                                  std::vector<int>{B}, n_threads)[0]);
+}
+
+// Função conta_caixas: as contagens são inteiras, então somar os vetores de
+// cada thread dá o mesmo resultado em qualquer ordem. Cada bloco é contado
+// para todos os histogramas enquanto ainda está no cache.
+inline std::vector<std::vector<Contagem>> conta_caixas(const double *valores, std::size_t n,
+                                                       double xmin, double xmax,
+                                                       const std::vector<int> &caixas,
+                                                       int n_threads) {
+    auto n_blocos = (n + valores_por_bloco - 1) / valores_por_bloco;
+    n_threads = std::max(1, n_threads);
+    // parciais[thread][histograma][caixa]
+    std::vector<std::vector<std::vector<Contagem>>> parciais(n_threads);
+    for (auto &parcial : parciais) {
+        for (auto B : caixas) { parcial.emplace_back(B, 0); }
+    }
+    executa_em_paralelo(n_blocos, n_threads, [&](int thread, std::size_t b) {
+        auto inicio = b * valores_por_bloco;
+        auto fim = std::min(inicio + valores_por_bloco, n);
+        for (std::size_t h = 0; h < caixas.size(); h++) {
+            conta_bloco(valores + inicio, fim - inicio, xmin, xmax, caixas[h],
+                        parciais[thread][h].data());
+        }
+    });
+    // soma as contagens de todas as threads
+    auto contagens = std::move(parciais[0]);
+    for (int t = 1; t < n_threads; t++) {
+        for (std::size_t h = 0; h < caixas.size(); h++) {
+            for (int i = 0; i < caixas[h]; i++) { contagens[h][i] += parciais[t][h][i]; }
+        }
+    }
+    return contagens;
+}
+
+inline bool usa_esparso(int B, std::size_t n) {
+    return B > static_cast<int>(valores_por_bloco) && static_cast<std::size_t>(B) > n;
+}
+
+// Função conta_bloco_esparso: ordena os índices das caixas dos valores e
+// conta as repetições. Usa indice_caixa, que dá as mesmas caixas que o
+// kernel de conta_bloco.
+inline std::vector<CaixaEsparsa> conta_bloco_esparso(const double *valores, std::size_t n,
+                                                     double xmin, double xmax, int B) {
+    std::vector<int> indices(n);
+    double delta = (xmax - xmin) / B;
+    for (std::size_t i = 0; i < n; i++) {
+        indices[i] = indice_caixa(valores[i], xmin, xmax, delta, B);
+    }
+    std::sort(indices.begin(), indices.end());
+    std::vector<CaixaEsparsa> caixas;
+    for (auto indice : indices) {
+        if (caixas.empty() || caixas.back().first != indice) {
+            caixas.push_back({indice, 0});
+        }
+        caixas.back().second++;
+    }
+    return caixas;
+}
+
+// Função junta_esparsos: junta as listas duas a duas, em rodadas paralelas,
+// como num merge sort.
+inline std::vector<CaixaEsparsa> junta_esparsos(std::vector<std::vector<CaixaEsparsa>> listas,
+                                                int n_threads) {
+    if (listas.empty()) { return {}; }
+    while (listas.size() > 1) {
+        std::vector<std::vector<CaixaEsparsa>> juntas((listas.size() + 1) / 2);
+        executa_em_paralelo(juntas.size(), n_threads, [&](int, std::size_t i) {
+            if (2*i + 1 == listas.size()) {
+                juntas[i] = std::move(listas[2*i]);
+                return;
+            }
+            auto &a = listas[2*i];
+            auto &b = listas[2*i + 1];
+            auto &junta = juntas[i];
+            junta.reserve(a.size() + b.size());
+            std::size_t ia = 0, ib = 0;
+            while (ia < a.size() || ib < b.size()) {
+                if (ib == b.size() || (ia < a.size() && a[ia].first < b[ib].first)) {
+                    junta.push_back(a[ia++]);
+                } else if (ia == a.size() || b[ib].first < a[ia].first) {
+                    junta.push_back(b[ib++]);
+                } else {
+                    junta.push_back({a[ia].first, a[ia].second + b[ib].second});
+                    ia++;
+                    ib++;
+                }
+            }
+        });
+        listas = std::move(juntas);
+    }
+    return std::move(listas[0]);
+}
+
+// Função monta_vetor_informacao calcula os limites como xmin + i*delta,
+// sempre da mesma forma, para que a saída não dependa do modo usado.
+inline std::vector<double> monta_vetor_informacao(double xmin, double xmax, int B) {
+    std::vector<double> vetinformacao;
+    vetinformacao.reserve(B + 1);
+    double delta = (xmax - xmin)/B;
+    // loop preenche o vetor de informações
+    for (int i = 0; i <= B; i++) {
+        vetinformacao.push_back(xmin + i*delta);
+    }
+    return vetinformacao;
+}
+
+// Função limita_quociente: o quociente fica em [0, B-1] antes de ser
+// convertido para int, o que não é definido para NaN ou fora do int. Se
+// xmax-xmin estoura para inf, o quociente pode ser NaN; ele vai para a
+// primeira caixa.
+inline double limita_quociente(double q, int B) {
+    if (!(q >= 0)) { return 0; }
+    return std::min(q, double(B-1));
+}
+
+// Função indice_caixa: o valor igual a xmax vai para a última caixa.
+// O arredondamento de delta pode levar um valor muito perto de xmax para a
+// caixa B, que também é contada na última. Se todos os valores são iguais
+// (delta == 0) todos são iguais a xmax e vão para a última caixa.
+inline int indice_caixa(double valor, double xmin, double xmax, double delta, int B) {
+    if (valor == xmax) { return B-1; }
+    return (int)limita_quociente((valor-xmin) / delta, B);
+}
+
+
+//=====================================================================
+//
+// Quantis aproximados
+//
+//=====================================================================
+
+// Capacidade do nível h: k no nível mais alto, diminuindo por 2/3 a cada
+// nível abaixo, com no mínimo 8 valores.
+inline void EsbocoQuantis::cria_niveis(std::size_t n_niveis) {
+    _niveis.resize(n_niveis);
+    _capacidades.resize(n_niveis);
+    _capacidade_total = 0;
+    double c = k;
+    for (std::size_t h = n_niveis; h-- > 0; c *= 2.0 / 3.0) {
+        _capacidades[h] = std::max<std::size_t>(static_cast<std::size_t>(std::ceil(c)), 8);
+        _capacidade_total += _capacidades[h];
+    }
+}
+
+inline void EsbocoQuantis::comprime() {
+    std::size_t h = 0;
+    while (_niveis[h].size() < _capacidades[h]) { h++; }
+    if (h + 1 == _niveis.size()) { cria_niveis(_niveis.size() + 1); }
+
+    auto &nivel = _niveis[h];
+    auto &acima = _niveis[h + 1];
+    std::sort(nivel.begin(), nivel.end());
+    // com tamanho ímpar o menor valor fica neste nível
+    std::size_t primeiro = nivel.size() % 2;
+    _estado ^= _estado << 13;
+    _estado ^= _estado >> 7;
+    _estado ^= _estado << 17;
+    for (std::size_t i = primeiro + (_estado & 1); i < nivel.size(); i += 2) {
+        acima.push_back(nivel[i]);
+    }
+    _guardados -= nivel.size() - primeiro - (nivel.size() - primeiro) / 2;
+    nivel.resize(primeiro);
+}
+
+inline void EsbocoQuantis::adiciona(double valor) {
+    if (_niveis.empty()) { cria_niveis(1); }
+    _niveis[0].push_back(valor);
+    _n++;
+    _guardados++;
+    while (_guardados >= _capacidade_total) { comprime(); }
+}
+
+inline void EsbocoQuantis::combina(const EsbocoQuantis &outro) {
+    if (outro._n == 0) { return; }
+    if (_niveis.size() < outro._niveis.size()) { cria_niveis(outro._niveis.size()); }
+    for (std::size_t h = 0; h < outro._niveis.size(); h++) {
+        _niveis[h].insert(_niveis[h].end(), outro._niveis[h].begin(), outro._niveis[h].end());
+    }
+    _n += outro._n;
+    _guardados += outro._guardados;
+    while (_guardados >= _capacidade_total) { comprime(); }
+}
+
+// Função quantil: ordena os valores guardados com seus pesos 2^h e retorna
+// o primeiro cujo peso acumulado chega a q*n.
+inline double EsbocoQuantis::quantil(double q) const {
+    if (_n == 0) { return std::numeric_limits<double>::quiet_NaN(); }
+    std::vector<std::pair<double, std::uint64_t>> pesados;
+    for (std::size_t h = 0; h < _niveis.size(); h++) {
+        for (auto valor : _niveis[h]) { pesados.push_back({valor, std::uint64_t{1} << h}); }
+    }
+    std::sort(pesados.begin(), pesados.end());
+    double alvo = q * static_cast<double>(_n);
+    std::uint64_t acumulado = 0;
+    for (auto [valor, peso] : pesados) {
+        acumulado += peso;
+        if (static_cast<double>(acumulado) >= alvo) { return valor; }
+    }
+    return pesados.back().first;
+}
+
+inline EsbocoQuantis esboco_bloco(const double *valores, std::size_t n) {
+    EsbocoQuantis esboco;
+    for (std::size_t i = 0; i < n; i++) { esboco.adiciona(valores[i]); }
+    return esboco;
+}
+
+//=====================================================================
+//
+// Percentis exatos
+//
+//=====================================================================
+
+// Função calcula_percentis: seleção com vários pivôs. As posições
+// ordenadas necessárias são separadas pela do meio: nth_element coloca esse
+// valor no lugar e divide o vetor em duas partes independentes, cada uma
+// com as posições que caem nela. Cada onda processa todas as partes em
+// paralelo e gera as da onda seguinte. O tempo esperado é O(n log r) para r
+// posições, sem ordenar o vetor nem copiá-lo.
+inline std::vector<double> calcula_percentis(double *valores, std::size_t n,
+                                             const std::vector<double> &percentis, int n_threads) {
+    if (n == 0) {
+        return std::vector<double>(percentis.size(), std::numeric_limits<double>::quiet_NaN());
+    }
+
+    // posições (0 a n-1) que a interpolação linear usa
+    std::vector<std::size_t> posicoes;
+    for (auto p : percentis) {
+        auto x = p / 100 * static_cast<double>(n - 1);
+        auto abaixo = static_cast<std::size_t>(x);
+        posicoes.push_back(abaixo);
+        if (abaixo + 1 < n) { posicoes.push_back(abaixo + 1); }
+    }
+    std::sort(posicoes.begin(), posicoes.end());
+    posicoes.erase(std::unique(posicoes.begin(), posicoes.end()), posicoes.end());
+
+    // parte [inicio, fim) do vetor e posições [p_inicio, p_fim) que caem nela
+    struct Parte {
+        std::size_t inicio, fim, p_inicio, p_fim;
+    };
+    std::vector<Parte> partes{{0, n, 0, posicoes.size()}};
+    while (!partes.empty()) {
+        std::vector<Parte> seguintes(2 * partes.size(), Parte{0, 0, 0, 0});
+        executa_em_paralelo(partes.size(), n_threads, [&](int, std::size_t i) {
+            auto [inicio, fim, p_inicio, p_fim] = partes[i];
+            auto p_meio = (p_inicio + p_fim) / 2;
+            auto k = posicoes[p_meio];
+            std::nth_element(valores + inicio, valores + k, valores + fim);
+            seguintes[2 * i] = {inicio, k, p_inicio, p_meio};
+            seguintes[2 * i + 1] = {k + 1, fim, p_meio + 1, p_fim};
+        });
+        partes.clear();
+        for (auto &parte : seguintes) {
+            if (parte.p_inicio < parte.p_fim) { partes.push_back(parte); }
+        }
+    }
+
+    std::vector<double> resultado;
+    for (auto p : percentis) {
+        auto x = p / 100 * static_cast<double>(n - 1);
+        auto abaixo = static_cast<std::size_t>(x);
+        auto acima = std::min(abaixo + 1, n - 1);
+        auto fracao = x - static_cast<double>(abaixo);
+        resultado.push_back(valores[abaixo] + (valores[acima] - valores[abaixo]) * fracao);
+    }
+    return resultado;
+}
+
+
+//=====================================================================
+//
+// Kernels vetoriais
+//
+//=====================================================================
+
+// As somas usam soma compensada de Kahan em faixas independentes: o valor i
+// vai para a faixa i % faixas e as faixas são juntadas no fim sempre na
+// mesma ordem. As versões escalar, SSE2 e AVX2 fazem as mesmas operações
+// nas mesmas faixas. O erro da soma compensada não cresce com o número de
+// valores, ao contrário da soma simples.
+constexpr int faixas = 16;
+
+// Resultado da primeira passada de um bloco.
+struct SomaMinMax {
+    double soma;
+    double xmin;
+    double xmax;
+};
+
+// Passo da soma de Kahan: c guarda o que se perdeu no arredondamento.
+inline void soma_kahan(double &s, double &c, double valor) {
+    double y = valor - c;
+    double t = s + y;
+    c = (t - s) - y;
+    s = t;
+}
+
+// Junta as faixas em uma soma só, também compensada.
+inline double junta_faixas(const double *s, const double *c) {
+    double total = 0, compensacao = 0;
+    for (int f = 0; f < faixas; f++) {
+        soma_kahan(total, compensacao, s[f]);
+        soma_kahan(total, compensacao, -c[f]);
+    }
+    return total - compensacao;
+}
+
+// Termina escalarmente os valores [i, n) que sobraram do laço vetorial.
+inline SomaMinMax termina_soma_minmax(const double *x, std::size_t i, std::size_t n,
+                                      double *s, double *c, double xmin, double xmax) {
+    for (; i < n; i++) {
+        soma_kahan(s[i % faixas], c[i % faixas], x[i]);
+        xmin = std::min(xmin, x[i]);
+        xmax = std::max(xmax, x[i]);
+    }
+    return {junta_faixas(s, c), xmin, xmax};
+}
+
+inline double termina_soma_quadrados(const double *x, std::size_t i, std::size_t n, double media,
+                                     double *s, double *c) {
+    for (; i < n; i++) {
+        double d = x[i] - media;
+        soma_kahan(s[i % faixas], c[i % faixas], d * d);
+    }
+    return junta_faixas(s, c);
+}
+
+inline SomaMinMax soma_minmax_escalar(const double *x, std::size_t n) {
+    double s[faixas] = {}, c[faixas] = {};
+    return termina_soma_minmax(x, 0, n, s, c, std::numeric_limits<double>::infinity(),
+                               -std::numeric_limits<double>::infinity());
+}
+
+inline double soma_quadrados_escalar(const double *x, std::size_t n, double media) {
+    double s[faixas] = {}, c[faixas] = {};
+    return termina_soma_quadrados(x, 0, n, media, s, c);
+}
+
+// Kernel de contagem: (valor-xmin)/delta é trocado por (valor-xmin)*inverso.
+// O produto pode diferir da divisão no último bit, o que só muda a caixa se
+// o quociente estiver muito perto de um inteiro; nesses casos (raros) a
+// divisão é refeita, então as caixas são sempre as mesmas de indice_caixa.
+// A folga 2^-48 relativa cobre com sobra os ~3 ulps de diferença possíveis.
+constexpr double folga_quociente = 0x1p-48;
+
+inline void conta_escalar(const double *x, std::size_t n, double xmin, double delta, int B,
+                          Contagem *contagem) {
+    double inverso = 1 / delta;
+    for (std::size_t i = 0; i < n; i++) {
+        double d = x[i] - xmin;
+        double q = limita_quociente(d * inverso, B);
+        int k = (int)q;
+        // parte fracionária perto de 0 ou de 1: refaz com a divisão
+        double fracao = q - k;
+        if (fracao <= q * folga_quociente || 1 - fracao <= q * folga_quociente) {
+            k = (int)limita_quociente(d / delta, B);
+        }
+        contagem[k] += 1;
+    }
+}
+
+#ifdef PROJETO1_X86
+
+#ifdef __SSE2__
+inline SomaMinMax soma_minmax_sse2(const double *x, std::size_t n) {
+    constexpr int r = faixas / 2;
+    __m128d s[r], c[r];
+    __m128d vmin = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    __m128d vmax = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    for (int k = 0; k < r; k++) { s[k] = c[k] = _mm_setzero_pd(); }
+    std::size_t i = 0;
+    for (; i + faixas <= n; i += faixas) {
+        for (int k = 0; k < r; k++) {
+            __m128d v = _mm_loadu_pd(x + i + 2*k);
+            __m128d y = _mm_sub_pd(v, c[k]);
+            __m128d t = _mm_add_pd(s[k], y);
+            c[k] = _mm_sub_pd(_mm_sub_pd(t, s[k]), y);
+            s[k] = t;
+            vmin = _mm_min_pd(vmin, v);
+            vmax = _mm_max_pd(vmax, v);
+        }
+    }
+    double ls[faixas], lc[faixas], lmin[2], lmax[2];
+    for (int k = 0; k < r; k++) {
+        _mm_storeu_pd(ls + 2*k, s[k]);
+        _mm_storeu_pd(lc + 2*k, c[k]);
+    }
+    _mm_storeu_pd(lmin, vmin);
+    _mm_storeu_pd(lmax, vmax);
+    return termina_soma_minmax(x, i, n, ls, lc, std::min(lmin[0], lmin[1]),
+                               std::max(lmax[0], lmax[1]));
+}
+
+inline double soma_quadrados_sse2(const double *x, std::size_t n, double media) {
+    constexpr int r = faixas / 2;
+    __m128d s[r], c[r];
+    __m128d vmedia = _mm_set1_pd(media);
+    for (int k = 0; k < r; k++) { s[k] = c[k] = _mm_setzero_pd(); }
+    std::size_t i = 0;
+    for (; i + faixas <= n; i += faixas) {
+        for (int k = 0; k < r; k++) {
+            __m128d d = _mm_sub_pd(_mm_loadu_pd(x + i + 2*k), vmedia);
+            __m128d y = _mm_sub_pd(_mm_mul_pd(d, d), c[k]);
+            __m128d t = _mm_add_pd(s[k], y);
+            c[k] = _mm_sub_pd(_mm_sub_pd(t, s[k]), y);
+            s[k] = t;
+        }
+    }
+    double ls[faixas], lc[faixas];
+    for (int k = 0; k < r; k++) {
+        _mm_storeu_pd(ls + 2*k, s[k]);
+        _mm_storeu_pd(lc + 2*k, c[k]);
+    }
+    return termina_soma_quadrados(x, i, n, media, ls, lc);
+}
+
+inline void conta_sse2(const double *x, std::size_t n, double xmin, double delta, int B,
+                       Contagem *contagem) {
+    __m128d vxmin = _mm_set1_pd(xmin);
+    __m128d vinverso = _mm_set1_pd(1 / delta);
+    __m128d vdelta = _mm_set1_pd(delta);
+    __m128d vfolga = _mm_set1_pd(folga_quociente);
+    __m128d sem_sinal = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+    __m128d vultima = _mm_set1_pd(B-1);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d d = _mm_sub_pd(_mm_loadu_pd(x + i), vxmin);
+        __m128d q = _mm_mul_pd(d, vinverso);
+        // quociente arredondado para o inteiro mais próximo
+        __m128d r = _mm_cvtepi32_pd(_mm_cvtpd_epi32(q));
+        __m128d perto = _mm_cmple_pd(_mm_and_pd(_mm_sub_pd(q, r), sem_sinal), _mm_mul_pd(q, vfolga));
+        if (_mm_movemask_pd(perto)) {
+            __m128d exato = _mm_div_pd(d, vdelta);
+            q = _mm_or_pd(_mm_and_pd(perto, exato), _mm_andnot_pd(perto, q));
+        }
+        // limita a [0, B-1] antes de converter; maxpd dá 0 para NaN
+        q = _mm_min_pd(_mm_max_pd(q, _mm_setzero_pd()), vultima);
+        __m128i k = _mm_cvttpd_epi32(q);
+        contagem[_mm_cvtsi128_si32(k)] += 1;
+        contagem[_mm_cvtsi128_si32(_mm_shuffle_epi32(k, 1))] += 1;
+    }
+    conta_escalar(x + i, n - i, xmin, delta, B, contagem);
+}
+#endif
+
+__attribute__((target("avx2")))
+inline SomaMinMax soma_minmax_avx2(const double *x, std::size_t n) {
+    constexpr int r = faixas / 4;
+    __m256d s[r], c[r];
+    __m256d vmin = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    __m256d vmax = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    for (int k = 0; k < r; k++) { s[k] = c[k] = _mm256_setzero_pd(); }
+    std::size_t i = 0;
+    for (; i + faixas <= n; i += faixas) {
+        for (int k = 0; k < r; k++) {
+            __m256d v = _mm256_loadu_pd(x + i + 4*k);
+            __m256d y = _mm256_sub_pd(v, c[k]);
+            __m256d t = _mm256_add_pd(s[k], y);
+            c[k] = _mm256_sub_pd(_mm256_sub_pd(t, s[k]), y);
+            s[k] = t;
+            vmin = _mm256_min_pd(vmin, v);
+            vmax = _mm256_max_pd(vmax, v);
+        }
+    }
+    double ls[faixas], lc[faixas], lmin[4], lmax[4];
+    for (int k = 0; k < r; k++) {
+        _mm256_storeu_pd(ls + 4*k, s[k]);
+        _mm256_storeu_pd(lc + 4*k, c[k]);
+    }
+    _mm256_storeu_pd(lmin, vmin);
+    _mm256_storeu_pd(lmax, vmax);
+    return termina_soma_minmax(x, i, n, ls, lc, *std::min_element(lmin, lmin + 4),
+                               *std::max_element(lmax, lmax + 4));
+}
+
+__attribute__((target("avx2")))
+inline double soma_quadrados_avx2(const double *x, std::size_t n, double media) {
+    constexpr int r = faixas / 4;
+    __m256d s[r], c[r];
+    __m256d vmedia = _mm256_set1_pd(media);
+    for (int k = 0; k < r; k++) { s[k] = c[k] = _mm256_setzero_pd(); }
+    std::size_t i = 0;
+    for (; i + faixas <= n; i += faixas) {
+        for (int k = 0; k < r; k++) {
+            __m256d d = _mm256_sub_pd(_mm256_loadu_pd(x + i + 4*k), vmedia);
+            __m256d y = _mm256_sub_pd(_mm256_mul_pd(d, d), c[k]);
+            __m256d t = _mm256_add_pd(s[k], y);
+            c[k] = _mm256_sub_pd(_mm256_sub_pd(t, s[k]), y);
+            s[k] = t;
+        }
+    }
+    double ls[faixas], lc[faixas];
+    for (int k = 0; k < r; k++) {
+        _mm256_storeu_pd(ls + 4*k, s[k]);
+        _mm256_storeu_pd(lc + 4*k, c[k]);
+    }
+    return termina_soma_quadrados(x, i, n, media, ls, lc);
+}
+
+__attribute__((target("avx2")))
+inline void conta_avx2(const double *x, std::size_t n, double xmin, double delta, int B,
+                       Contagem *contagem) {
+    __m256d vxmin = _mm256_set1_pd(xmin);
+    __m256d vinverso = _mm256_set1_pd(1 / delta);
+    __m256d vdelta = _mm256_set1_pd(delta);
+    __m256d vfolga = _mm256_set1_pd(folga_quociente);
+    __m256d sem_sinal = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    __m256d vultima = _mm256_set1_pd(B-1);
+    alignas(16) int k[4];
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d d = _mm256_sub_pd(_mm256_loadu_pd(x + i), vxmin);
+        __m256d q = _mm256_mul_pd(d, vinverso);
+        __m256d r = _mm256_round_pd(q, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256d perto = _mm256_cmp_pd(_mm256_and_pd(_mm256_sub_pd(q, r), sem_sinal),
+                                      _mm256_mul_pd(q, vfolga), _CMP_LE_OQ);
+        if (_mm256_movemask_pd(perto)) {
+            q = _mm256_blendv_pd(q, _mm256_div_pd(d, vdelta), perto);
+        }
+        // limita a [0, B-1] antes de converter; maxpd dá 0 para NaN
+        q = _mm256_min_pd(_mm256_max_pd(q, _mm256_setzero_pd()), vultima);
+        _mm_store_si128(reinterpret_cast<__m128i *>(k), _mm256_cvttpd_epi32(q));
+        contagem[k[0]] += 1;
+        contagem[k[1]] += 1;
+        contagem[k[2]] += 1;
+        contagem[k[3]] += 1;
+    }
+    conta_escalar(x + i, n - i, xmin, delta, B, contagem);
+}
+
+#endif // PROJETO1_X86
+
+// Estrutura com os kernels escolhidos para o processador em uso.
+struct Kernels {
+    SomaMinMax (*soma_minmax)(const double *, std::size_t);
+    double (*soma_quadrados)(const double *, std::size_t, double);
+    void (*conta)(const double *, std::size_t, double, double, int, Contagem *);
+};
+
+// Função que escolhe os kernels uma única vez, na primeira chamada: AVX2 se
+// o processador tiver, senão SSE2, senão a versão escalar.
+inline const Kernels &kernels() {
+    static const Kernels escolhidos = [] {
+#ifdef PROJETO1_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernels{soma_minmax_avx2, soma_quadrados_avx2, conta_avx2};
+        }
+#ifdef __SSE2__
+        return Kernels{soma_minmax_sse2, soma_quadrados_sse2, conta_sse2};
+#endif
+#endif
+        return Kernels{soma_minmax_escalar, soma_quadrados_escalar, conta_escalar};
+    }();
+    return escolhidos;
+}
+
+// Função momentos_bloco: média pela soma compensada e m2 pela soma dos
+// quadrados dos desvios em relação a essa média (duas passadas no bloco,
+// que está no cache).
+inline Momentos momentos_bloco(const double *valores, std::size_t n) {
+    Momentos m;
+    if (n == 0) { return m; }
+    auto [soma, xmin, xmax] = kernels().soma_minmax(valores, n);
+    m.n = n;
+    m.media = soma / n;
+    m.m2 = kernels().soma_quadrados(valores, n, m.media);
+    m.xmin = xmin;
+    m.xmax = xmax;
+    return m;
+}
+
+inline void conta_bloco(const double *valores, std::size_t n, double xmin, double xmax, int B,
+                        Contagem *contagem) {
+    // todos os valores iguais: vão para a última caixa, como em indice_caixa
+    if (xmin == xmax) {
+        contagem[B-1] += static_cast<Contagem>(n);
+        return;
+    }
+    kernels().conta(valores, n, xmin, (xmax - xmin)/B, B, contagem);
+}
+
+#endif // PROJETO1_ESTATISTICAS_HPP
@@ -1,10 +1,39 @@
-#include <algorithm>  // Para std::sort
-#include <fstream>    // Para std::ifstream
+#include <algorithm>  // Para std::min, std::copy
+#include <atomic>     // Para std::atomic
+#include <chrono>     // Para std::chrono::milliseconds
+#include <charconv>   // Para std::from_chars, std::to_chars
+#include <cctype>     // Para std::isdigit
+#include <cstdint>    // Para std::uint64_t, std::int64_t
+#include <cstdio>     // Para std::snprintf
+#include <cstring>    // Para std::memcpy
+#include <cstdlib>    // Para std::exit
+#include <deque>      // Para std::deque
+#include <filesystem> // Para std::filesystem::directory_iterator
+#include <fstream>    // Para std::ifstream, std::ofstream
 #include <functional> // Para std::function
 #include <iostream>   // Para std::cout, std::endl
-#include <string>     // Para std::string, std::stod
+#include <limits>     // Para std::numeric_limits
+#include <memory>     // Para std::unique_ptr
+#include <mutex>      // Para std::mutex
+#include <string>     // Para std::string
+#include <thread>     // Para std::thread
 #include <vector>     // Para std::vector
-#include <cmath>      // Para std::pow, std::sqrt
+#include <cmath>      // Para std::sqrt, std::isfinite
+
+#include "estatisticas.hpp" // Para os acumuladores de momentos e histogramas
+
+#ifdef _WIN32
+#include <windows.h>  // Para CreateFileMapping, MapViewOfFile
+#include <psapi.h>    // Para GetProcessMemoryInfo
+#include <fcntl.h>    // Para _O_BINARY
+#include <io.h>       // Para _setmode
+#else
+#include <fcntl.h>    // Para open
+#include <sys/mman.h> // Para mmap, munmap
+#include <sys/resource.h> // Para getrusage
+#include <sys/stat.h> // Para fstat
+#include <unistd.h>   // Para close
+#endif
 
 //=====================================================================
 //
@@ -12,14 +41,241 @@
 //
 //=====================================================================
 
-// Função que lê os dados double do arquivo.
-std::vector<double> le_arquivo(std::string nome_arquivo);
+// Erro ao ler um arquivo de dados: mensagem e código de saída do programa
+// (2: arquivo não pode ser aberto, 3: conteúdo inválido).
+struct ErroLeitura {
+    std::string mensagem;
+    int codigo;
+};
+
+// Tempos e contadores do --profile.
+class Perfil;
+
+// Opções da linha de comando.
+struct Opcoes {
+    // lê o arquivo em blocos, com memória constante
+    bool streaming{false};
+    // threads usadas nos cálculos (ou arquivos processados ao mesmo tempo no lote)
+    int n_threads{1};
+    // processa vários arquivos, cada um com seu arquivo de saída
+    bool lote{false};
+    // diretório dos arquivos de saída do lote (vazio: o mesmo do arquivo)
+    std::string diretorio_saida;
+    // usa (e cria) o cache binário <arquivo>.cache ao lado do arquivo
+    bool cache{false};
+    // continua lendo o que for acrescentado ao arquivo
+    bool acompanha{false};
+    // intervalo entre as verificações do modo acompanha, em milissegundos
+    int intervalo{1000};
+    // mostra mediana, p90 e p99 aproximados (EsbocoQuantis)
+    bool quantis{false};
+    // percentis exatos pedidos com --percentiles; substituem os aproximados
+    std::vector<double> percentis;
+    // escreve a saída no formato binário em vez do texto dos .out
+    bool binario{false};
+    // com --profile, onde os tempos das fases são guardados; nulo sem ele
+    Perfil *perfil{nullptr};
+};
+
+// Classe Perfil: tempo de parede e tempo de CPU (de todas as threads) de
+// cada fase da execução, bytes lidos e valores convertidos. As fases só são
+// marcadas nas passagens de uma fase para outra, nunca por valor, então sem
+// --profile o custo é só testar um ponteiro nulo algumas vezes.
+class Perfil {
+    struct Fase {
+        std::string nome;
+        double parede;
+        double cpu;
+    };
+    std::vector<Fase> _fases;
+    std::chrono::steady_clock::time_point _inicio_parede;
+    double _inicio_cpu{0};
+    bool _em_fase{false};
+
+public:
+    std::uint64_t bytes_lidos{0};
+    std::uint64_t valores_convertidos{0};
+
+    // termina a fase atual, se houver, e começa a fase nome
+    void inicia(const std::string &nome);
+    void termina();
+    // escreve as fases e os contadores como um objeto JSON, em uma linha
+    void escreve_json(std::ostream &saida, const std::string &nome_arquivo,
+                      const Opcoes &opcoes) const;
+};
+
+// Função que começa a fase nome se --profile foi pedido.
+inline void marca_fase(const Opcoes &opcoes, const char *nome) {
+    if (opcoes.perfil != nullptr) { opcoes.perfil->inicia(nome); }
+}
+
+// Função que retorna o tempo de CPU do processo, em segundos.
+double tempo_cpu();
+
+// Função que retorna o pico de memória residente do processo, em KB.
+std::uint64_t pico_memoria_kb();
+
+// Classe que mapeia o arquivo inteiro em memória (somente leitura).
+class ArquivoMapeado;
+
+// Função que lê os dados double do arquivo. Com mais de uma thread o arquivo
+// é dividido em pedaços convertidos em paralelo.
+std::vector<double> le_arquivo(std::string nome_arquivo, int n_threads = 1);
+
+// Função que converte o texto [inicio, fim) chamando guarda(valor) para cada
+// valor. Retorna o início do primeiro token inválido, ou nullptr.
+template <typename Guarda>
+const char *converte_texto(const char *inicio, const char *fim, Guarda guarda);
+
+// Função que converte o texto [inicio, fim) em valores double e os coloca
+// no final do vetor valores. deslocamento é a posição de inicio no arquivo,
+// usada apenas na mensagem de erro.
+void converte_valores(const char *inicio, const char *fim, std::size_t deslocamento,
+                      std::vector<double> &valores);
+
+// Função que lança ErroLeitura com o token inválido e sua posição.
+[[noreturn]] void erro_valor_invalido(const char *token, const char *fim, std::size_t posicao);
+
+// Função que lê o arquivo em blocos de tamanho fixo e entrega os valores
+// de cada bloco para a função consumidor. A memória usada não depende
+// do tamanho do arquivo. Lê os bytes [inicio, limite); com so_completos o
+// último token só é lido se já tiver um espaço depois dele. Retorna a
+// posição do arquivo até onde os valores foram lidos.
+std::size_t le_em_blocos(const std::string &nome_arquivo,
+                         const std::function<void(const std::vector<double> &)> &consumidor,
+                         std::size_t inicio = 0,
+                         std::size_t limite = std::numeric_limits<std::size_t>::max(),
+                         bool so_completos = false);
 
 // Função que recebe vetor de dados e retorna média e desvio padrão
-std::tuple<double,double> calcula_media_desvio(std::vector<double> valores);
+std::tuple<double,double> calcula_media_desvio(const std::vector<double> &valores, int n_threads = 1);
+
+// Percentuais mostrados com --quantiles.
+const std::vector<double> percentuais_quantis = {50, 90, 99};
+
+// Resultado de um arquivo: momentos, um histograma por número de caixas
+// e, se pedidos, os quantis (percentual, valor), aproximados ou exatos.
+struct Resultado {
+    Momentos momentos;
+    std::vector<Histograma> histogramas;
+    std::vector<std::pair<double, double>> quantis;
+};
+
+// Função que preenche os quantis do resultado a partir do esboço.
+void preenche_quantis(Resultado &resultado, const EsbocoQuantis &esboco);
+
+// Função que preenche os quantis do resultado com os percentis exatos
+// pedidos nas opções. Reordena os valores no lugar.
+void preenche_percentis(Resultado &resultado, double *valores, std::size_t n,
+                        const Opcoes &opcoes);
+
+// Função que escreve o resultado com um dos histogramas no formato dos
+// arquivos .out; os quantis, se houver, vêm depois das caixas.
+void mostra_resultado(std::ostream &saida, const Resultado &resultado,
+                      const Histograma &histograma);
+
+// Função que escreve o resultado com um dos histogramas no formato binário.
+void mostra_resultado_binario(std::ostream &saida, const Resultado &resultado,
+                              const Histograma &histograma);
 
 // Função que monta o histograma e retorna o vetor informação e o vetor de contagem
-std::tuple<std::vector<double>,std::vector<int>> monta_histograma(std::vector<double> valores, int B);
+std::tuple<std::vector<double>,std::vector<Contagem>> monta_histograma(const std::vector<double> &valores, int B, int n_threads = 1);
+
+// Função que mostra como executar o programa.
+void uso(std::string nome_programa);
+
+// Função que lê um número inteiro, como o de --threads. Retorna false se o
+// texto não for inteiro um número.
+bool le_inteiro(const std::string &texto, int &valor);
+
+// Função que lê a lista de números de caixas, como "10,20,50".
+std::vector<int> le_caixas(const std::string &texto);
+
+// Função que lê a lista de percentis, como "50,90,99.9".
+std::vector<double> le_percentis(const std::string &texto);
+
+// Função que lê um arquivo e calcula as estatísticas e um histograma para
+// cada número de caixas. Lança ErroLeitura se o arquivo não puder ser lido.
+Resultado calcula_arquivo(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                          const Opcoes &opcoes);
+
+// Função que escreve o resultado: na saída padrão, um histograma depois do
+// outro, ou, no modo lote ou com --out-dir, em <nome>_<B>.out (ou .bin).
+void escreve_resultado(const std::string &nome_arquivo, const Resultado &resultado,
+                       const Opcoes &opcoes);
+
+// Formato do arquivo <arquivo>.cache: o cabeçalho abaixo seguido dos n
+// valores double, na ordem de bytes da máquina que o escreveu. O cache só
+// vale se o tamanho e a data de modificação do arquivo de texto forem os
+// mesmos de quando ele foi escrito.
+struct CabecalhoCache {
+    char magica[8];
+    std::uint32_t versao;
+    std::uint32_t tamanho_double;
+    // tamanho e data de modificação do arquivo de texto
+    std::uint64_t tamanho_fonte;
+    std::int64_t modificacao_fonte;
+    std::uint64_t n;
+    double xmin;
+    double xmax;
+    // média e soma dos quadrados dos desvios, como calculadas pelo programa
+    double media;
+    double m2;
+};
+
+// Classe EscritorCache: escreve os valores num arquivo temporário e só no fim
+// escreve o cabeçalho e renomeia para o nome final, para que um cache
+// incompleto nunca seja usado. Falhas ao escrever o cache só geram um aviso.
+class EscritorCache {
+    std::string _caminho;
+    std::string _temporario;
+    std::ofstream _arquivo;
+    CabecalhoCache _cabecalho{};
+    bool _ok{false};
+
+public:
+    explicit EscritorCache(const std::string &nome_arquivo);
+    ~EscritorCache();
+
+    // Acrescenta n valores ao cache.
+    void adiciona(const double *valores, std::size_t n);
+
+    // Escreve o cabeçalho com os momentos e coloca o cache no lugar.
+    void termina(const Momentos &momentos);
+};
+
+// Modo streaming: calcula o mesmo resultado lendo o arquivo em blocos,
+// sem guardar os valores na memória. Se cache não for nulo, os valores lidos
+// também são escritos nele.
+Resultado calcula_streaming(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                            const Opcoes &opcoes, EscritorCache *cache = nullptr);
+
+// Função que calcula o resultado a partir do cache binário do arquivo, se
+// ele existir e ainda corresponder ao arquivo. Retorna false se não puder.
+bool calcula_do_cache(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                      const Opcoes &opcoes, Resultado &resultado);
+
+// Pool de threads com roubo de trabalho, usado no modo lote.
+class PoolRouboTrabalho;
+
+// Histograma interno de caixas finas, que pode ser reagrupado em quaisquer
+// B caixas sem reler os valores.
+class HistogramaFino;
+
+// Classe que guarda o estado do modo acompanha: momentos e histogramas dos
+// valores já lidos e a posição do arquivo onde a leitura parou.
+class AcompanhaArquivo;
+
+// Modo acompanha: escreve o resultado e, a cada intervalo, lê só os bytes
+// acrescentados ao arquivo e escreve o resultado atualizado. Não retorna.
+[[noreturn]] void executa_acompanhamento(const std::string &nome_arquivo,
+                                         const std::vector<int> &caixas, const Opcoes &opcoes);
+
+// Modo lote: processa os arquivos (ou os .dat dos diretórios) ao mesmo
+// tempo, escrevendo cada resultado em <nome>_<B>.out. Retorna o código de
+// saída do programa.
+int executa_lote(const std::vector<std::string> &entradas, const std::vector<int> &caixas,
+                 const Opcoes &opcoes);
 
 //=====================================================================
 //
@@ -27,34 +283,100 @@ std::tuple<std::vector<double>,std::vector<int>> monta_histograma(std::vector<do
 //
 //=====================================================================
 
-int main(int , char const *argv[]) {
-    // recebe valores da linha de comando.
-    auto nome_arquivo = argv[1];
-    auto B = std::stoi(argv[2]);
-    
-    // chama a função que le os dados do arquivo.
-    auto valores = le_arquivo(nome_arquivo);
-
-    // calcula média e desvio padrão do vetor.
-    auto [media, desvio] = calcula_media_desvio(valores);
-    
-    // Cria um vetor com as caixas do histograma.
-    auto [vetinfo, vetcont] = monta_histograma(valores, B);
-    
-    // Mostra a contagem de elementes
-    std::cout << valores.size() << std::endl;
+// Com PROJETO1_SEM_MAIN o arquivo pode ser incluído por outro programa,
+// como o benchmark.cpp, que usa as mesmas funções.
+#ifndef PROJETO1_SEM_MAIN
+int main(int argc, char const *argv[]) {
+    // separa as opções dos argumentos posicionais.
+    Opcoes opcoes;
+    Perfil perfil;
+    std::vector<std::string> argumentos;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stream") {
+            opcoes.streaming = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!le_inteiro(argv[++i], opcoes.n_threads)) {
+                uso(argv[0]);
+                std::exit(1);
+            }
+            // 0 usa todos os núcleos da máquina
+            if (opcoes.n_threads <= 0) {
+                opcoes.n_threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        } else if (arg == "--batch") {
+            opcoes.lote = true;
+        } else if (arg == "--out-dir" && i + 1 < argc) {
+            opcoes.diretorio_saida = argv[++i];
+        } else if (arg == "--cache") {
+            opcoes.cache = true;
+        } else if (arg == "--follow") {
+            opcoes.acompanha = true;
+        } else if (arg == "--binary") {
+            opcoes.binario = true;
+        } else if (arg == "--quantiles") {
+            opcoes.quantis = true;
+        } else if (arg == "--percentiles" && i + 1 < argc) {
+            opcoes.percentis = le_percentis(argv[++i]);
+            if (opcoes.percentis.empty()) {
+                uso(argv[0]);
+                std::exit(1);
+            }
+        } else if (arg == "--profile") {
+            opcoes.perfil = &perfil;
+        } else if (arg == "--interval" && i + 1 < argc) {
+            if (!le_inteiro(argv[++i], opcoes.intervalo)) {
+                uso(argv[0]);
+                std::exit(1);
+            }
+            opcoes.intervalo = std::max(1, opcoes.intervalo);
+        } else if (arg.rfind("--", 0) == 0) {
+            uso(argv[0]);
+            std::exit(1);
+        } else {
+            argumentos.push_back(arg);
+        }
+    }
+    // os percentis exatos precisam de todos os valores na memória; o perfil
+    // é de um arquivo só, do início ao fim
+    if (argumentos.size() < 2 || (!opcoes.lote && argumentos.size() != 2) ||
+        (opcoes.lote && opcoes.acompanha) ||
+        (!opcoes.percentis.empty() && (opcoes.streaming || opcoes.acompanha)) ||
+        (opcoes.perfil != nullptr && (opcoes.lote || opcoes.acompanha))) {
+        uso(argv[0]);
+        std::exit(1);
+    }
 
-    // Mostra média e desvio padrão
-    std::cout << media << std::endl;
-    std::cout << desvio << std::endl;
+    // recebe valores da linha de comando: o número de caixas é o último.
+    auto caixas = le_caixas(argumentos.back());
+    argumentos.pop_back();
+    if (caixas.empty()) {
+        uso(argv[0]);
+        std::exit(1);
+    }
 
-    // Mostra a caixa e contagem do histograma
-    for (int i = 0 ; i < B; i++) {
-        std::cout << vetinfo[i] << ' ';
-        std::cout << vetinfo[i+1] << ' ';
-        std::cout << vetcont[i] << std::endl;
+    if (opcoes.lote) {
+        return executa_lote(argumentos, caixas, opcoes);
     }
+
+    try {
+        if (opcoes.acompanha) {
+            executa_acompanhamento(argumentos[0], caixas, opcoes);
+        }
+        auto resultado = calcula_arquivo(argumentos[0], caixas, opcoes);
+        marca_fase(opcoes, "saida");
+        escreve_resultado(argumentos[0], resultado, opcoes);
+        if (opcoes.perfil != nullptr) {
+            perfil.termina();
+            perfil.escreve_json(std::cerr, argumentos[0], opcoes);
+        }
+    } catch (const ErroLeitura &erro) {
+        std::cerr << erro.mensagem << std::endl;
+        return erro.codigo;
+    }
+    return 0;
 }
+#endif // PROJETO1_SEM_MAIN
 
 //=====================================================================
 //
@@ -62,80 +384,1178 @@ int main(int , char const *argv[]) {
 //
 //=====================================================================
 
+void uso(std::string nome_programa) {
+    std::cerr << "Uso: " << nome_programa << " [opções] <arquivo> <caixas>\n"
+              << "     " << nome_programa << " --batch [opções] <arquivo ou diretório>... <caixas>\n"
+              << "  <caixas> é um número de caixas ou uma lista, como 10,20,50\n"
+              << "  --stream       lê o arquivo em blocos, com memória constante\n"
+              << "  --threads N    usa N threads (0 = todos os núcleos)\n"
+              << "  --batch        escreve o resultado de cada arquivo em <nome>_<caixas>.out\n"
+              << "  --out-dir DIR  diretório dos arquivos <nome>_<caixas>.out\n"
+              << "  --cache        guarda os valores em <arquivo>.cache e os reusa depois\n"
+              << "  --follow       continua lendo o que for acrescentado ao arquivo\n"
+              << "  --interval MS  intervalo entre as leituras do --follow (padrão 1000)\n"
+              << "  --profile      escreve em stderr, em JSON, o tempo de cada fase, bytes lidos,\n"
+              << "                 valores convertidos e pico de memória (sem --batch e --follow)\n"
+              << "  --binary       escreve a saída no formato binário (<nome>_<caixas>.bin)\n"
+              << "  --quantiles    mostra p50, p90 e p99 aproximados depois das caixas\n"
+              << "  --percentiles LISTA  mostra os percentis exatos da lista, como 50,90,99.9\n"
+              << "                 (não funciona com --stream nem --follow)\n";
+}
+
+bool le_inteiro(const std::string &texto, int &valor) {
+    auto [resto, erro] = std::from_chars(texto.data(), texto.data() + texto.size(), valor);
+    return erro == std::errc() && resto == texto.data() + texto.size();
+}
+
+// Função le_caixas: retorna a lista vazia se algum item não for um número
+// positivo.
+std::vector<int> le_caixas(const std::string &texto) {
+    std::vector<int> caixas;
+    std::size_t inicio = 0;
+    while (inicio <= texto.size()) {
+        auto fim = std::min(texto.find(',', inicio), texto.size());
+        int B = 0;
+        auto [resto, erro] = std::from_chars(texto.data() + inicio, texto.data() + fim, B);
+        if (erro != std::errc() || resto != texto.data() + fim || B <= 0) { return {}; }
+        caixas.push_back(B);
+        inicio = fim + 1;
+    }
+    return caixas;
+}
+
+// Função le_percentis: retorna a lista vazia se algum item não for um número
+// entre 0 e 100.
+std::vector<double> le_percentis(const std::string &texto) {
+    std::vector<double> percentis;
+    std::size_t inicio = 0;
+    while (inicio <= texto.size()) {
+        auto fim = std::min(texto.find(',', inicio), texto.size());
+        double p = 0;
+        auto [resto, erro] = std::from_chars(texto.data() + inicio, texto.data() + fim, p);
+        if (erro != std::errc() || resto != texto.data() + fim || !(p >= 0 && p <= 100)) {
+            return {};
+        }
+        percentis.push_back(p);
+        inicio = fim + 1;
+    }
+    return percentis;
+}
+
+void preenche_quantis(Resultado &resultado, const EsbocoQuantis &esboco) {
+    resultado.quantis.clear();
+    for (auto percentual : percentuais_quantis) {
+        resultado.quantis.push_back({percentual, esboco.quantil(percentual / 100)});
+    }
+}
+
+void preenche_percentis(Resultado &resultado, double *valores, std::size_t n,
+                        const Opcoes &opcoes) {
+    auto percentis = calcula_percentis(valores, n, opcoes.percentis, opcoes.n_threads);
+    resultado.quantis.clear();
+    for (std::size_t i = 0; i < percentis.size(); i++) {
+        resultado.quantis.push_back({opcoes.percentis[i], percentis[i]});
+    }
+}
+
+// Função calcula_arquivo: os valores são lidos uma vez e o mínimo e o
+// máximo calculados uma vez para todos os histogramas.
+// Com --cache, um cache válido evita ler o texto; sem cache válido o
+// arquivo é lido normalmente e o cache é escrito para a próxima vez.
+Resultado calcula_arquivo(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                          const Opcoes &opcoes) {
+    Resultado resultado;
+    if (opcoes.cache) { marca_fase(opcoes, "le_cache"); }
+    if (opcoes.cache && calcula_do_cache(nome_arquivo, caixas, opcoes, resultado)) {
+        return resultado;
+    }
+    std::unique_ptr<EscritorCache> cache;
+    if (opcoes.cache) {
+        cache = std::make_unique<EscritorCache>(nome_arquivo);
+    }
+
+    if (opcoes.streaming) {
+        resultado = calcula_streaming(nome_arquivo, caixas, opcoes, cache.get());
+        if (cache) { cache->termina(resultado.momentos); }
+        return resultado;
+    }
+
+    // chama a função que le os dados do arquivo.
+    marca_fase(opcoes, "le_arquivo");
+    auto valores = le_arquivo(nome_arquivo, opcoes.n_threads);
+    if (opcoes.perfil != nullptr) {
+        opcoes.perfil->bytes_lidos += std::filesystem::file_size(nome_arquivo);
+        opcoes.perfil->valores_convertidos += valores.size();
+    }
+
+    // calcula média, desvio padrão, mínimo e máximo do vetor.
+    marca_fase(opcoes, "calcula_media_desvio");
+    AcumuladorMomentos momentos(opcoes.quantis, opcoes.n_threads);
+    momentos.push(valores);
+    resultado.momentos = momentos.result();
+    if (opcoes.quantis) { preenche_quantis(resultado, momentos.esboco()); }
+
+    if (cache) {
+        marca_fase(opcoes, "escreve_cache");
+        cache->adiciona(valores.data(), valores.size());
+        cache->termina(resultado.momentos);
+    }
+
+    // Cria os histogramas, densos ou esparsos.
+    marca_fase(opcoes, "monta_histograma");
+    AcumuladorHistogramas histogramas(resultado.momentos, caixas, opcoes.n_threads);
+    histogramas.push(valores);
+    resultado.histogramas = histogramas.result();
+
+    // por último, porque reordena os valores
+    if (!opcoes.percentis.empty()) {
+        marca_fase(opcoes, "percentis");
+        preenche_percentis(resultado, valores.data(), valores.size(), opcoes);
+    }
+    return resultado;
+}
+
+void escreve_resultado(const std::string &nome_arquivo, const Resultado &resultado,
+                       const Opcoes &opcoes) {
+    namespace fs = std::filesystem;
+
+    auto mostra = opcoes.binario ? mostra_resultado_binario : mostra_resultado;
+
+    if (!opcoes.lote && opcoes.diretorio_saida.empty()) {
+#ifdef _WIN32
+        if (opcoes.binario) { _setmode(_fileno(stdout), _O_BINARY); }
+#endif
+        for (auto &histograma : resultado.histogramas) {
+            mostra(std::cout, resultado, histograma);
+        }
+        return;
+    }
+
+    fs::path arquivo(nome_arquivo);
+    auto diretorio = opcoes.diretorio_saida.empty() ? arquivo.parent_path()
+                                                    : fs::path(opcoes.diretorio_saida);
+    for (auto &histograma : resultado.histogramas) {
+        auto nome_saida = arquivo.stem().string() + "_" +
+                          std::to_string(histograma.n_caixas()) +
+                          (opcoes.binario ? ".bin" : ".out");
+        std::ofstream saida(diretorio / nome_saida, std::ios::binary);
+        mostra(saida, resultado, histograma);
+        if (!saida.good()) {
+            throw ErroLeitura{"Erro ao escrever " + (diretorio / nome_saida).string(), 2};
+        }
+    }
+}
+
+// Classe EscritorSaida: junta a saída num buffer e a escreve no ostream em
+// pedaços grandes, em vez de um flush por linha. Os números são convertidos
+// com std::to_chars; double sai como no operator<< padrão (%g, 6 dígitos).
+class EscritorSaida {
+    static constexpr std::size_t tamanho_buffer = 1 << 16;
+    // espaço que basta para qualquer número convertido
+    static constexpr std::size_t maior_numero = 32;
+    std::ostream &_saida;
+    std::vector<char> _buffer;
+    std::size_t _usado{0};
+
+    char *reserva(std::size_t n) {
+        if (_usado + n > _buffer.size()) { descarrega(); }
+        return _buffer.data() + _usado;
+    }
+
+public:
+    explicit EscritorSaida(std::ostream &saida) : _saida(saida), _buffer(tamanho_buffer) {}
+    ~EscritorSaida() {
+        descarrega();
+        _saida.flush();
+    }
+
+    EscritorSaida &operator<<(char c) {
+        *reserva(1) = c;
+        _usado++;
+        return *this;
+    }
+
+    EscritorSaida &operator<<(double valor) {
+        auto inicio = reserva(maior_numero);
+        auto fim = std::to_chars(inicio, inicio + maior_numero, valor,
+                                 std::chars_format::general, 6).ptr;
+        _usado += fim - inicio;
+        return *this;
+    }
+
+    template <typename Inteiro>
+    std::enable_if_t<std::is_integral_v<Inteiro>, EscritorSaida &> operator<<(Inteiro valor) {
+        auto inicio = reserva(maior_numero);
+        _usado += std::to_chars(inicio, inicio + maior_numero, valor).ptr - inicio;
+        return *this;
+    }
+
+    // escreve n bytes sem conversão (formato binário)
+    void escreve(const void *dados, std::size_t n) {
+        if (n > tamanho_buffer) {
+            descarrega();
+            _saida.write(static_cast<const char *>(dados), static_cast<std::streamsize>(n));
+            return;
+        }
+        std::memcpy(reserva(n), dados, n);
+        _usado += n;
+    }
+
+    void descarrega() {
+        _saida.write(_buffer.data(), static_cast<std::streamsize>(_usado));
+        _usado = 0;
+    }
+};
+
+// Função mostra_resultado: contagem, média, desvio e uma linha por caixa.
+void mostra_resultado(std::ostream &saida, const Resultado &resultado,
+                      const Histograma &histograma) {
+    auto &momentos = resultado.momentos;
+    EscritorSaida escritor(saida);
+
+    // Mostra a contagem de elementes
+    escritor << momentos.n << '\n';
+
+    // Mostra média e desvio padrão
+    escritor << momentos.media << '\n';
+    escritor << momentos.desvio() << '\n';
+
+    // Mostra a caixa e contagem do histograma
+    if (histograma.eh_esparso()) {
+        // caixas que não estão na lista têm contagem 0
+        double delta = (histograma.xmax - histograma.xmin) / histograma.B;
+        auto caixa = histograma.esparso.begin();
+        for (int i = 0; i < histograma.B; i++) {
+            Contagem contagem = 0;
+            if (caixa != histograma.esparso.end() && caixa->first == i) {
+                contagem = caixa->second;
+                ++caixa;
+            }
+            escritor << histograma.xmin + i*delta << ' ';
+            escritor << histograma.xmin + (i+1)*delta << ' ';
+            escritor << contagem << '\n';
+        }
+    } else {
+        auto &vetinfo = histograma.vetinfo;
+        auto &vetcont = histograma.vetcont;
+        for (std::size_t i = 0 ; i < vetcont.size(); i++) {
+            escritor << vetinfo[i] << ' ';
+            escritor << vetinfo[i+1] << ' ';
+            escritor << vetcont[i] << '\n';
+        }
+    }
+
+    // Mostra os quantis como "p<percentual> <valor>"
+    for (auto [percentual, valor] : resultado.quantis) {
+        escritor << 'p' << percentual << ' ' << valor << '\n';
+    }
+}
+
+// Formato binário (--binary), um por histograma, na ordem de bytes da
+// máquina: o cabeçalho abaixo, n_cheias pares (caixa, contagem) uint64 das
+// caixas não vazias em ordem de caixa e n_quantis pares (percentual, valor)
+// double. Os limites da caixa i são xmin + i*(xmax-xmin)/B, como no texto.
+struct CabecalhoBinario {
+    char magica[8];
+    std::uint32_t versao;
+    std::uint32_t B;
+    std::uint64_t n;
+    double media;
+    double desvio;
+    double xmin;
+    double xmax;
+    std::uint64_t n_cheias;
+    std::uint64_t n_quantis;
+};
+
+void mostra_resultado_binario(std::ostream &saida, const Resultado &resultado,
+                              const Histograma &histograma) {
+    // caixas não vazias; o histograma denso é convertido aqui
+    std::vector<CaixaEsparsa> denso;
+    if (!histograma.eh_esparso()) {
+        for (std::size_t i = 0; i < histograma.vetcont.size(); i++) {
+            if (histograma.vetcont[i] != 0) {
+                denso.push_back({static_cast<int>(i), histograma.vetcont[i]});
+            }
+        }
+    }
+    auto &cheias = histograma.eh_esparso() ? histograma.esparso : denso;
+
+    auto &momentos = resultado.momentos;
+    CabecalhoBinario cabecalho{{'P', '1', 'H', 'I', 'S', 'T', 0, 0}, 2,
+                               static_cast<std::uint32_t>(histograma.n_caixas()), momentos.n,
+                               momentos.media, momentos.desvio(), momentos.xmin, momentos.xmax,
+                               cheias.size(), resultado.quantis.size()};
+    EscritorSaida escritor(saida);
+    escritor.escreve(&cabecalho, sizeof(cabecalho));
+    for (auto [caixa, contagem] : cheias) {
+        std::uint64_t par[2] = {static_cast<std::uint64_t>(caixa),
+                                static_cast<std::uint64_t>(contagem)};
+        escritor.escreve(par, sizeof(par));
+    }
+    for (auto [percentual, valor] : resultado.quantis) {
+        double par[2] = {percentual, valor};
+        escritor.escreve(par, sizeof(par));
+    }
+}
+
+// Classe ArquivoMapeado: mapeia o arquivo em memória para que os valores
+// sejam convertidos direto dos bytes do arquivo, sem copiar cada token
+// para uma std::string.
+class ArquivoMapeado {
+    const char *_dados{nullptr};
+    std::size_t _tamanho{0};
+#ifdef _WIN32
+    HANDLE _arquivo{INVALID_HANDLE_VALUE};
+    HANDLE _mapa{nullptr};
+#endif
+public:
+    // Construtor: lança ErroLeitura se o arquivo não puder ser aberto.
+    explicit ArquivoMapeado(const std::string &nome_arquivo) {
+#ifdef _WIN32
+        _arquivo = CreateFileA(nome_arquivo.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER tamanho;
+        if (_arquivo == INVALID_HANDLE_VALUE || !GetFileSizeEx(_arquivo, &tamanho)) {
+            libera();
+            throw ErroLeitura{"Erro ao abrir " + nome_arquivo, 2};
+        }
+        _tamanho = static_cast<std::size_t>(tamanho.QuadPart);
+        // arquivo vazio não pode ser mapeado, mas também não tem valores
+        if (_tamanho == 0) { return; }
+        _mapa = CreateFileMappingA(_arquivo, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_mapa != nullptr) {
+            _dados = static_cast<const char *>(MapViewOfFile(_mapa, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        int fd = open(nome_arquivo.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) { close(fd); }
+            throw ErroLeitura{"Erro ao abrir " + nome_arquivo, 2};
+        }
+        _tamanho = static_cast<std::size_t>(info.st_size);
+        // arquivo vazio não pode ser mapeado, mas também não tem valores
+        if (_tamanho > 0) {
+            void *p = mmap(nullptr, _tamanho, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                _dados = static_cast<const char *>(p);
+                // o arquivo é lido do início ao fim uma única vez
+                madvise(p, _tamanho, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (_tamanho == 0) { return; }
+#endif
+        if (_dados == nullptr) {
+            libera();
+            throw ErroLeitura{"Erro ao mapear " + nome_arquivo + " em memória", 2};
+        }
+    }
+
+    ArquivoMapeado(const ArquivoMapeado &) = delete;
+    ArquivoMapeado &operator=(const ArquivoMapeado &) = delete;
+
+    ~ArquivoMapeado() { libera(); }
+
+    // Leitura
+    const char *dados() const { return _dados; }
+    std::size_t tamanho() const { return _tamanho; }
+
+private:
+    void libera() {
+#ifdef _WIN32
+        if (_dados != nullptr) { UnmapViewOfFile(_dados); }
+        if (_mapa != nullptr) { CloseHandle(_mapa); }
+        if (_arquivo != INVALID_HANDLE_VALUE) { CloseHandle(_arquivo); }
+#else
+        if (_dados != nullptr) { munmap(const_cast<char *>(_dados), _tamanho); }
+#endif
+        _dados = nullptr;
+    }
+};
+
+// Verifica se o caractere separa dois valores no arquivo.
+inline bool eh_espaco(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
 // Função le_arquivo recebe o nome do arquivo e
 // retorn um vetor double com todos os valores.
-std::vector<double> le_arquivo(std::string nome_arquivo) {
-    // importa o arquivo
-    std::ifstream arquivo(nome_arquivo);
+// Em paralelo: o arquivo é cortado em pedaços, sempre num espaço, e cada
+// pedaço é percorrido duas vezes por uma thread: primeiro conta os tokens,
+// para saber onde os valores do pedaço começam no vetor de saída, depois
+// converte os valores direto para essa fatia do vetor.
+std::vector<double> le_arquivo(std::string nome_arquivo, int n_threads) {
+    // tamanho mínimo de um pedaço, para não gastar mais criando threads
+    constexpr std::size_t tamanho_minimo_pedaco = 1 << 20;
+
+    // mapeia o arquivo em memória
+    ArquivoMapeado arquivo(nome_arquivo);
+    const char *dados = arquivo.dados();
+    const char *fim = dados + arquivo.tamanho();
     // variavel de saida da funcao
     std::vector<double> valores;
-    // variavel que recebe texto do arquivo
-    std::string valor;
 
-    // loop enquanto estiver lendo o arquivo
-    while ( arquivo.good() && !arquivo.eof() ) {
-        // passa para valor o texto seguinte.
-        arquivo >> valor;
-        // verifica se ainda tem texto
-        if ( arquivo.good() ) {
-            // converte a string para double e coloca no vetor.
-            valores.push_back(std::stod(valor));
+    std::size_t n_pedacos = std::min<std::size_t>(std::max(n_threads, 1) * 4,
+                                                  arquivo.tamanho() / tamanho_minimo_pedaco);
+    if (n_threads <= 1 || n_pedacos <= 1) {
+        // estimativa de um valor a cada ~8 bytes, evita realocações
+        valores.reserve(arquivo.tamanho() / 8);
+        // converte todos os valores direto dos bytes do arquivo
+        converte_valores(dados, fim, 0, valores);
+        // vetor de saida.
+        return valores;
+    }
+
+    // limites dos pedaços, avançados até o próximo espaço
+    std::vector<const char *> limites(n_pedacos + 1, fim);
+    limites[0] = dados;
+    for (std::size_t k = 1; k < n_pedacos; k++) {
+        const char *p = std::max(dados + k * (arquivo.tamanho() / n_pedacos), limites[k-1]);
+        while (p != fim && !eh_espaco(*p)) { ++p; }
+        limites[k] = p;
+    }
+
+    // conta os tokens de cada pedaço
+    std::vector<std::size_t> inicio_pedaco(n_pedacos + 1, 0);
+    executa_em_paralelo(n_pedacos, n_threads, [&](int, std::size_t k) {
+        std::size_t n = 0;
+        bool em_token = false;
+        for (const char *p = limites[k]; p != limites[k+1]; ++p) {
+            bool espaco = eh_espaco(*p);
+            n += !espaco && !em_token;
+            em_token = !espaco;
         }
+        inicio_pedaco[k+1] = n;
+    });
+    for (std::size_t k = 0; k < n_pedacos; k++) { inicio_pedaco[k+1] += inicio_pedaco[k]; }
+
+    // converte cada pedaço na sua fatia do vetor de saída
+    valores.resize(inicio_pedaco[n_pedacos]);
+    std::vector<const char *> invalidos(n_pedacos, nullptr);
+    executa_em_paralelo(n_pedacos, n_threads, [&](int, std::size_t k) {
+        double *saida = valores.data() + inicio_pedaco[k];
+        invalidos[k] = converte_texto(limites[k], limites[k+1], [&](double valor) { *saida++ = valor; });
+    });
+
+    // mostra o primeiro token inválido do arquivo, como na leitura sequencial
+    for (auto token : invalidos) {
+        if (token != nullptr) { erro_valor_invalido(token, fim, token - dados); }
     }
     // vetor de saida.
     return valores;
 }
 
-// Função que cálcula média e desvio padrão do vetor de entrada.
-std::tuple<double,double> calcula_media_desvio(std::vector<double> valores) {
-    double media{0}, desvio{0};
-    // loop soma o vetor valores
-    for (auto valor : valores) {
-        media += valor;
+// Função converte_texto percorre o texto separando os tokens por espaço
+// e converte cada um com std::from_chars, sem alocação por valor.
+template <typename Guarda>
+const char *converte_texto(const char *inicio, const char *fim, Guarda guarda) {
+    const char *p = inicio;
+    while (true) {
+        // pula os espaços antes do token
+        while (p != fim && eh_espaco(*p)) { ++p; }
+        if (p == fim) { return nullptr; }
+        const char *token = p;
+        // std::from_chars não aceita o sinal '+', que std::stod aceitava;
+        // só é pulado antes de um dígito ou '.', para que "+-3" seja inválido
+        if (*p == '+' && p + 1 != fim && (std::isdigit(static_cast<unsigned char>(p[1])) || p[1] == '.')) {
+            ++p;
+        }
+        double valor;
+        auto [resto, erro] = std::from_chars(p, fim, valor);
+        // o token tem que ser inteiro um número, e finito: inf e nan fariam
+        // o índice da caixa sair do histograma
+        if (erro != std::errc() || (resto != fim && !eh_espaco(*resto)) || !std::isfinite(valor)) {
+            return token;
+        }
+        guarda(valor);
+        p = resto;
+    }
+}
+
+// Função converte_valores: um token que não é um número é um ErroLeitura
+// com a sua posição em bytes.
+void converte_valores(const char *inicio, const char *fim, std::size_t deslocamento,
+                      std::vector<double> &valores) {
+    auto token = converte_texto(inicio, fim, [&](double valor) { valores.push_back(valor); });
+    if (token != nullptr) {
+        erro_valor_invalido(token, fim, deslocamento + (token - inicio));
+    }
+}
+
+void erro_valor_invalido(const char *token, const char *fim, std::size_t posicao) {
+    const char *fim_token = token;
+    while (fim_token != fim && !eh_espaco(*fim_token)) { ++fim_token; }
+    throw ErroLeitura{"Erro: valor inválido '" + std::string(token, fim_token) +
+                      "' na posição " + std::to_string(posicao), 3};
+}
+
+// Função le_em_blocos lê o arquivo em pedaços de tamanho fixo. O token que
+// fica cortado no fim de um bloco é movido para o início do próximo.
+std::size_t le_em_blocos(const std::string &nome_arquivo,
+                         const std::function<void(const std::vector<double> &)> &consumidor,
+                         std::size_t inicio, std::size_t limite, bool so_completos) {
+    // tamanho do bloco lido por vez
+    constexpr std::size_t tamanho_bloco = 1 << 20;
+
+    std::ifstream arquivo(nome_arquivo, std::ios::binary);
+    if (!arquivo.good()) {
+        throw ErroLeitura{"Erro ao abrir " + nome_arquivo, 2};
+    }
+    arquivo.seekg(static_cast<std::streamoff>(inicio));
+
+    std::vector<char> bloco(tamanho_bloco);
+    std::vector<double> valores;
+    // bytes do arquivo já convertidos, para a posição nas mensagens de erro
+    std::size_t deslocamento = inicio;
+    // bytes do token cortado que ficaram no início do bloco
+    std::size_t sobra = 0;
+
+    while (true) {
+        auto pedido = std::min(tamanho_bloco - sobra, limite - (deslocamento + sobra));
+        arquivo.read(bloco.data() + sobra, static_cast<std::streamsize>(pedido));
+        auto lidos = static_cast<std::size_t>(arquivo.gcount());
+        auto fim = sobra + lidos;
+        bool acabou = lidos == 0 || arquivo.eof() || deslocamento + fim == limite;
+
+        // só converte até o último espaço, a não ser no fim do arquivo
+        auto corte = fim;
+        if (!acabou || so_completos) {
+            while (corte > 0 && !eh_espaco(bloco[corte - 1])) { corte--; }
+            if (corte == 0 && !acabou) {
+                throw ErroLeitura{"Erro: valor maior que " + std::to_string(tamanho_bloco) +
+                                  " bytes na posição " + std::to_string(deslocamento), 3};
+            }
+        }
+
+        valores.clear();
+        converte_valores(bloco.data(), bloco.data() + corte, deslocamento, valores);
+        if (!valores.empty()) { consumidor(valores); }
+
+        if (acabou) { return deslocamento + corte; }
+        // move o token cortado para o início do bloco
+        sobra = fim - corte;
+        std::copy(bloco.begin() + corte, bloco.begin() + fim, bloco.begin());
+        deslocamento += corte;
+    }
+}
+
+Resultado calcula_streaming(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                            const Opcoes &opcoes, EscritorCache *cache) {
+    // primeira passada: contagem, média, desvio, mínimo e máximo
+    // (no streaming a leitura e os cálculos se alternam, então as fases do
+    // perfil são as passadas)
+    marca_fase(opcoes, "le_arquivo+calcula_media_desvio");
+    AcumuladorMomentos momentos(opcoes.quantis);
+    auto lidos = le_em_blocos(nome_arquivo, [&](const std::vector<double> &valores) {
+        momentos.push(valores);
+        if (cache != nullptr) { cache->adiciona(valores.data(), valores.size()); }
+    });
+    Resultado resultado;
+    resultado.momentos = momentos.result();
+    if (opcoes.quantis) { preenche_quantis(resultado, momentos.esboco()); }
+
+    // segunda passada: contagem das caixas, já conhecendo xmin e xmax
+    marca_fase(opcoes, "le_arquivo+monta_histograma");
+    AcumuladorHistogramas histogramas(resultado.momentos, caixas);
+    lidos += le_em_blocos(nome_arquivo, [&](const std::vector<double> &valores) {
+        histogramas.push(valores);
+    });
+    resultado.histogramas = histogramas.result();
+    if (opcoes.perfil != nullptr) {
+        opcoes.perfil->bytes_lidos += lidos;
+        opcoes.perfil->valores_convertidos += 2 * resultado.momentos.n;
+    }
+    return resultado;
+}
+
+// Classe PoolRouboTrabalho: cada thread tem a sua fila de tarefas. Ela pega
+// tarefas do fim da própria fila e, quando a fila acaba, rouba do início da
+// fila de outra thread. Assim uma thread que recebeu arquivos pequenos ajuda
+// as que ficaram com arquivos grandes. As tarefas são todas adicionadas
+// antes de executa(), então uma thread que acha todas as filas vazias
+// simplesmente termina, sem esperar as outras.
+class PoolRouboTrabalho {
+    struct Fila {
+        std::mutex trava;
+        std::deque<std::function<void()>> tarefas;
+    };
+    std::vector<std::unique_ptr<Fila>> _filas;
+    // fila onde entra a próxima tarefa adicionada
+    std::atomic<std::size_t> _proxima_fila{0};
+
+    // tira uma tarefa da fila f: do fim se for a própria, do início se for roubo
+    bool pega(std::size_t f, bool propria, std::function<void()> &tarefa) {
+        std::lock_guard<std::mutex> trava(_filas[f]->trava);
+        auto &tarefas = _filas[f]->tarefas;
+        if (tarefas.empty()) { return false; }
+        if (propria) {
+            tarefa = std::move(tarefas.back());
+            tarefas.pop_back();
+        } else {
+            tarefa = std::move(tarefas.front());
+            tarefas.pop_front();
+        }
+        return true;
+    }
+
+    void trabalha(std::size_t t) {
+        std::function<void()> tarefa;
+        while (true) {
+            bool achou = pega(t, true, tarefa);
+            for (std::size_t k = 1; !achou && k < _filas.size(); k++) {
+                achou = pega((t + k) % _filas.size(), false, tarefa);
+            }
+            // nenhuma tarefa cria outras: filas vazias não voltam a encher
+            if (!achou) { return; }
+            tarefa();
+        }
+    }
+
+public:
+    explicit PoolRouboTrabalho(int n_threads) {
+        for (int t = 0; t < std::max(n_threads, 1); t++) {
+            _filas.push_back(std::make_unique<Fila>());
+        }
+    }
+
+    // Adiciona uma tarefa, distribuindo as tarefas entre as filas em rodízio.
+    // Deve ser chamada antes de executa().
+    void adiciona(std::function<void()> tarefa) {
+        auto f = _proxima_fila++ % _filas.size();
+        std::lock_guard<std::mutex> trava(_filas[f]->trava);
+        _filas[f]->tarefas.push_front(std::move(tarefa));
     }
-    // divide pela quantidade de elementos
-    media /= valores.size();
 
-    // calcula desvio padrão
-    for (auto valor : valores) {
-        desvio += std::pow(valor - media, 2);
+    // Executa todas as tarefas e retorna quando não houver mais nenhuma.
+    void executa() {
+        std::vector<std::thread> threads;
+        for (std::size_t t = 1; t < _filas.size(); t++) {
+            threads.emplace_back(&PoolRouboTrabalho::trabalha, this, t);
+        }
+        trabalha(0);
+        for (auto &t : threads) { t.join(); }
+    }
+};
+
+// Função executa_lote: os arquivos entram no pool do maior para o menor,
+// então os grandes começam primeiro e os pequenos preenchem o fim. Cada
+// arquivo é calculado com uma thread; o paralelismo vem de vários arquivos
+// ao mesmo tempo, o que também sobrepõe a leitura de um com o cálculo de
+// outro. Um arquivo com erro não interrompe os demais.
+int executa_lote(const std::vector<std::string> &entradas, const std::vector<int> &caixas,
+                 const Opcoes &opcoes) {
+    namespace fs = std::filesystem;
+
+    // expande os diretórios nos seus arquivos .dat
+    std::vector<std::pair<std::uintmax_t, fs::path>> arquivos;
+    for (auto &entrada : entradas) {
+        std::error_code erro;
+        if (fs::is_directory(entrada, erro)) {
+            std::vector<fs::path> dats;
+            for (auto &item : fs::directory_iterator(entrada, erro)) {
+                if (item.is_regular_file(erro) && item.path().extension() == ".dat") {
+                    dats.push_back(item.path());
+                }
+            }
+            std::sort(dats.begin(), dats.end());
+            for (auto &dat : dats) { arquivos.push_back({fs::file_size(dat, erro), dat}); }
+        } else {
+            arquivos.push_back({fs::file_size(entrada, erro), entrada});
+        }
     }
-    desvio = desvio / (valores.size() - 1);
-    desvio = std::sqrt(desvio);
+    std::stable_sort(arquivos.begin(), arquivos.end(),
+                     [](auto &a, auto &b) { return a.first > b.first; });
+
+    Opcoes opcoes_arquivo = opcoes;
+    opcoes_arquivo.n_threads = 1;
+    std::atomic<int> codigo{0};
+    std::mutex trava_erros;
+
+    // mais threads que arquivos só deixaria threads procurando tarefas
+    PoolRouboTrabalho pool(static_cast<int>(std::min<std::size_t>(opcoes.n_threads, arquivos.size())));
+    for (auto &item : arquivos) {
+        auto arquivo = item.second;
+        pool.adiciona([&, arquivo] {
+            try {
+                // os .out só são criados depois que o arquivo foi lido sem erro
+                auto resultado = calcula_arquivo(arquivo.string(), caixas, opcoes_arquivo);
+                escreve_resultado(arquivo.string(), resultado, opcoes_arquivo);
+            } catch (const ErroLeitura &erro) {
+                std::lock_guard<std::mutex> trava(trava_erros);
+                std::cerr << arquivo.string() << ": " << erro.mensagem << std::endl;
+                codigo = erro.codigo;
+            }
+        });
+    }
+    pool.executa();
+    return codigo;
+}
 
+// Função que cálcula média e desvio padrão do vetor de entrada.
+std::tuple<double,double> calcula_media_desvio(const std::vector<double> &valores, int n_threads) {
+    AcumuladorMomentos acumulador(false, n_threads);
+    acumulador.push(valores);
+    auto momentos = acumulador.result();
     // tupla de saida
-    return {media, desvio};
+    return {momentos.media, momentos.desvio()};
 }
 
 // Função que monta o histograma do vetor de entrada em um numero B de caixas
 // e retorna um tupla com o vetor informação e o vetor contagem.
 // vetor informação: valores de intervalo das caixas, tamanho: B+1.
 // vetor contagem: quantidade de elemento em cada caixa.
-std::tuple<std::vector<double>,std::vector<int>> monta_histograma(std::vector<double> valores, int B) {
-    // vetor de informação
-    std::vector<double> vetinformacao;
-    // vetor de contagem
-    std::vector<int> vetcontagem(B, {0});
-    // variaveis auxiliares
-    double xmin, xmax, delta;
-    int n;
-    // ordem o vetor valores em ordem crescente
-    std::sort(valores.begin(), valores.end());
+// Não ordena nem copia os valores: basta achar o menor e o maior e depois
+// passar uma vez contando as caixas.
+std::tuple<std::vector<double>,std::vector<Contagem>> monta_histograma(const std::vector<double> &valores, int B, int n_threads) {
+    if (valores.empty()) {
+        return {monta_vetor_informacao(0, 0, B), std::vector<Contagem>(B, {0})};
+    }
     // menor, maior valor do vetor valores
-    xmin = valores[0];
-    xmax = valores[valores.size()-1];
-    // calculo delta da caixa
-    delta = (xmax - xmin)/B;
-    // loop preenche o vetor de informações
-    for (int i = 0; i <= B; i++) {
-        vetinformacao.push_back(xmin + i*delta);
-    }
-    // loop preenche o velor de contagem
-    for (auto valor : valores) {
-        n = (int)( (valor-xmin) / delta);
-        if ( valor == xmax) { n = B-1; }
-        vetcontagem[n] += 1;
+    AcumuladorMomentos momentos(false, n_threads);
+    momentos.push(valores);
+    AcumuladorHistogramas histogramas(momentos.result(), {B}, n_threads);
+    histogramas.push(valores);
+    auto histograma = std::move(histogramas.result()[0]);
+    // esta função sempre retorna o vetor contagem denso
+    if (histograma.eh_esparso()) {
+        histograma.vetinfo = monta_vetor_informacao(histograma.xmin, histograma.xmax, B);
+        histograma.vetcont.assign(B, 0);
+        for (auto [caixa, contagem] : histograma.esparso) { histograma.vetcont[caixa] = contagem; }
     }
     // tupla de saida
-    return {vetinformacao, vetcontagem};
+    return {std::move(histograma.vetinfo), std::move(histograma.vetcont)};
+}
+
+//=====================================================================
+//
+// Perfil
+//
+//=====================================================================
+
+void Perfil::inicia(const std::string &nome) {
+    termina();
+    _fases.push_back({nome, 0, 0});
+    _em_fase = true;
+    _inicio_parede = std::chrono::steady_clock::now();
+    _inicio_cpu = tempo_cpu();
+}
+
+void Perfil::termina() {
+    if (!_em_fase) { return; }
+    std::chrono::duration<double> parede = std::chrono::steady_clock::now() - _inicio_parede;
+    _fases.back().parede = parede.count();
+    _fases.back().cpu = tempo_cpu() - _inicio_cpu;
+    _em_fase = false;
+}
+
+// Texto entre aspas no formato JSON.
+std::string texto_json(const std::string &texto) {
+    std::string json = "\"";
+    for (unsigned char c : texto) {
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            json += escape;
+        } else {
+            json += static_cast<char>(c);
+        }
+    }
+    return json + "\"";
+}
+
+void Perfil::escreve_json(std::ostream &saida, const std::string &nome_arquivo,
+                          const Opcoes &opcoes) const {
+    double total_parede = 0, total_cpu = 0;
+    saida << "{\"arquivo\":" << texto_json(nome_arquivo)
+          << ",\"modo\":\"" << (opcoes.streaming ? "stream" : "memoria") << "\""
+          << ",\"threads\":" << opcoes.n_threads << ",\"fases\":[";
+    for (std::size_t i = 0; i < _fases.size(); i++) {
+        auto &fase = _fases[i];
+        saida << (i > 0 ? "," : "") << "{\"nome\":" << texto_json(fase.nome)
+              << ",\"parede_s\":" << fase.parede << ",\"cpu_s\":" << fase.cpu << "}";
+        total_parede += fase.parede;
+        total_cpu += fase.cpu;
+    }
+    saida << "],\"parede_s\":" << total_parede << ",\"cpu_s\":" << total_cpu
+          << ",\"bytes_lidos\":" << bytes_lidos
+          << ",\"valores_convertidos\":" << valores_convertidos
+          << ",\"pico_rss_kb\":" << pico_memoria_kb() << "}" << std::endl;
+}
+
+double tempo_cpu() {
+#ifdef _WIN32
+    FILETIME criacao, saida, kernel, usuario;
+    GetProcessTimes(GetCurrentProcess(), &criacao, &saida, &kernel, &usuario);
+    auto segundos = [](const FILETIME &t) {
+        return ((static_cast<std::uint64_t>(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+    };
+    return segundos(kernel) + segundos(usuario);
+#else
+    rusage uso_recursos;
+    getrusage(RUSAGE_SELF, &uso_recursos);
+    auto segundos = [](const timeval &t) { return t.tv_sec + t.tv_usec * 1e-6; };
+    return segundos(uso_recursos.ru_utime) + segundos(uso_recursos.ru_stime);
+#endif
+}
+
+std::uint64_t pico_memoria_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS memoria;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &memoria, sizeof(memoria))) { return 0; }
+    return memoria.PeakWorkingSetSize / 1024;
+#else
+    rusage uso_recursos;
+    getrusage(RUSAGE_SELF, &uso_recursos);
+#ifdef __APPLE__
+    // no macOS ru_maxrss é em bytes
+    return static_cast<std::uint64_t>(uso_recursos.ru_maxrss) / 1024;
+#else
+    return static_cast<std::uint64_t>(uso_recursos.ru_maxrss);
+#endif
+#endif
+}
+
+//=====================================================================
+//
+// Modo acompanha
+//
+//=====================================================================
+
+// Classe HistogramaFino: a caixa k é [k*largura, (k+1)*largura), com a
+// largura uma potência de 2. Quando os valores passam a ocupar mais que
+// max_caixas caixas, a largura é multiplicada por 2^s e as caixas juntadas
+// (k vira k >> s), sem precisar dos valores. Assim a resolução fica entre
+// 1/max_caixas e 2/max_caixas da faixa dos dados e a memória é limitada.
+class HistogramaFino {
+    static constexpr std::int64_t max_caixas = 1 << 16;
+    double _largura{0};
+    // índice k da caixa _contagem[0]
+    std::int64_t _primeira{0};
+    std::deque<std::uint64_t> _contagem;
+
+    // junta as caixas 2^s a 2^s
+    void alarga(int s) {
+        std::deque<std::uint64_t> nova;
+        auto primeira = _primeira >> s;
+        for (std::size_t i = 0; i < _contagem.size(); i++) {
+            auto k = ((_primeira + static_cast<std::int64_t>(i)) >> s) - primeira;
+            if (static_cast<std::size_t>(k) >= nova.size()) { nova.resize(k + 1, 0); }
+            nova[k] += _contagem[i];
+        }
+        _contagem = std::move(nova);
+        _primeira = primeira;
+        _largura = std::ldexp(_largura, s);
+    }
+
+public:
+    void adiciona(double valor) {
+        if (_contagem.empty()) {
+            // começa bem fino; as caixas são juntadas conforme a faixa cresce.
+            // O expoente de um subnormal é limitado para que a largura não
+            // vire zero (2^(min_exponent-40) ainda é um subnormal).
+            int expoente = valor == 0 ? 0 : std::ilogb(valor);
+            expoente = std::max(expoente, std::numeric_limits<double>::min_exponent);
+            _largura = std::ldexp(1.0, expoente - 40);
+            _primeira = static_cast<std::int64_t>(std::floor(valor / _largura));
+            _contagem.push_back(0);
+        }
+        // evita que o índice k estoure o inteiro
+        while (std::fabs(valor / _largura) >= 0x1p62) { alarga(1); }
+        auto k = static_cast<std::int64_t>(std::floor(valor / _largura));
+        auto ultima = _primeira + static_cast<std::int64_t>(_contagem.size()) - 1;
+        auto menor = std::min(k, _primeira), maior = std::max(k, ultima);
+        int s = 0;
+        while ((maior >> s) - (menor >> s) >= max_caixas) { s++; }
+        if (s > 0) {
+            alarga(s);
+            // a largura é potência de 2, então floor(valor/(largura*2^s)) == k >> s
+            k >>= s;
+        }
+        if (k < _primeira) {
+            _contagem.insert(_contagem.begin(), _primeira - k, 0);
+            _primeira = k;
+        }
+        auto i = static_cast<std::size_t>(k - _primeira);
+        if (i >= _contagem.size()) { _contagem.resize(i + 1, 0); }
+        _contagem[i] += 1;
+    }
+
+    // Soma as caixas finas nas B caixas entre xmin e xmax pelo centro de cada
+    // caixa fina. Só os valores de uma caixa fina cortada por um limite das
+    // B caixas podem ser contados na caixa vizinha.
+    void reparte(double xmin, double xmax, int B, Contagem *contagem) const {
+        double delta = (xmax - xmin)/B;
+        for (std::size_t i = 0; i < _contagem.size(); i++) {
+            if (_contagem[i] == 0) { continue; }
+            double centro = (_primeira + static_cast<std::int64_t>(i) + 0.5) * _largura;
+            centro = std::min(std::max(centro, xmin), xmax);
+            contagem[indice_caixa(centro, xmin, xmax, delta, B)] += static_cast<Contagem>(_contagem[i]);
+        }
+    }
+};
+
+// Classe AcompanhaArquivo: enquanto os valores novos ficam dentro de
+// [xmin, xmax] eles são contados exatamente nas caixas atuais. Um valor
+// fora da faixa muda os limites de todas as caixas; nesse caso os
+// histogramas são refeitos a partir do HistogramaFino, sem reler o arquivo.
+// Os momentos são sempre exatos e iguais aos de uma execução completa.
+class AcompanhaArquivo {
+    std::string _nome;
+    std::vector<int> _caixas;
+    bool _quantis;
+    // posição do arquivo até onde os valores já foram lidos
+    std::size_t _posicao{0};
+    AcumuladorMomentos _acumulador;
+    HistogramaFino _fino;
+    // faixa dos histogramas atuais
+    double _xmin{0}, _xmax{0};
+    std::vector<Histograma> _histogramas;
+
+    // refaz os histogramas para a faixa [xmin, xmax] a partir das caixas finas
+    void reparte(double xmin, double xmax) {
+        _xmin = xmin;
+        _xmax = xmax;
+        _histogramas.clear();
+        for (auto B : _caixas) {
+            Histograma histograma{monta_vetor_informacao(xmin, xmax, B), std::vector<Contagem>(B, 0)};
+            if (xmin == xmax) {
+                histograma.vetcont[B-1] = static_cast<Contagem>(_acumulador.result().n);
+            } else {
+                _fino.reparte(xmin, xmax, B, histograma.vetcont.data());
+            }
+            _histogramas.push_back(std::move(histograma));
+        }
+    }
+
+public:
+    AcompanhaArquivo(const std::string &nome_arquivo, const std::vector<int> &caixas, bool quantis)
+        : _nome(nome_arquivo), _caixas(caixas), _quantis(quantis), _acumulador(quantis) {}
+
+    // Lê o arquivo do início, com os histogramas exatos (duas passadas).
+    void reinicia() {
+        _acumulador = AcumuladorMomentos(_quantis);
+        _fino = HistogramaFino{};
+        std::error_code erro;
+        auto tamanho = static_cast<std::size_t>(std::filesystem::file_size(_nome, erro));
+        if (erro) { throw ErroLeitura{"Erro ao abrir " + _nome, 2}; }
+
+        _posicao = le_em_blocos(_nome, [&](const std::vector<double> &valores) {
+            _acumulador.push(valores);
+            for (auto valor : valores) { _fino.adiciona(valor); }
+        }, 0, tamanho, true);
+
+        auto momentos = _acumulador.result();
+        _xmin = momentos.xmin;
+        _xmax = momentos.xmax;
+        _histogramas.clear();
+        for (auto B : _caixas) {
+            _histogramas.push_back({monta_vetor_informacao(_xmin, _xmax, B), std::vector<Contagem>(B, 0)});
+        }
+        if (momentos.n == 0) { return; }
+        le_em_blocos(_nome, [&](const std::vector<double> &valores) {
+            for (auto &histograma : _histogramas) {
+                conta_bloco(valores.data(), valores.size(), _xmin, _xmax,
+                            static_cast<int>(histograma.vetcont.size()), histograma.vetcont.data());
+            }
+        }, 0, _posicao, true);
+    }
+
+    // Lê os valores acrescentados desde a última leitura. Retorna true se
+    // houver valores novos. Se o arquivo diminuiu, ele é lido de novo.
+    bool atualiza() {
+        std::error_code erro;
+        auto tamanho = static_cast<std::size_t>(std::filesystem::file_size(_nome, erro));
+        if (erro) { throw ErroLeitura{"Erro ao abrir " + _nome, 2}; }
+        if (tamanho < _posicao) {
+            reinicia();
+            return true;
+        }
+        auto n_antes = _acumulador.result().n;
+        bool vazio = n_antes == 0;
+        _posicao = le_em_blocos(_nome, [&](const std::vector<double> &valores) {
+            double menor = _xmin, maior = _xmax;
+            _acumulador.push(valores);
+            for (auto valor : valores) {
+                _fino.adiciona(valor);
+                menor = std::min(menor, valor);
+                maior = std::max(maior, valor);
+            }
+            if (vazio || menor < _xmin || maior > _xmax) {
+                vazio = false;
+                reparte(std::min(menor, _xmin), std::max(maior, _xmax));
+                return;
+            }
+            for (auto &histograma : _histogramas) {
+                conta_bloco(valores.data(), valores.size(), _xmin, _xmax,
+                            static_cast<int>(histograma.vetcont.size()), histograma.vetcont.data());
+            }
+        }, _posicao, tamanho, true);
+        return _acumulador.result().n != n_antes;
+    }
+
+    Resultado resultado() const {
+        Resultado r{_acumulador.result(), _histogramas, {}};
+        if (_quantis) { preenche_quantis(r, _acumulador.esboco()); }
+        return r;
+    }
+};
+
+void executa_acompanhamento(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                            const Opcoes &opcoes) {
+    AcompanhaArquivo acompanha(nome_arquivo, caixas, opcoes.quantis);
+    acompanha.reinicia();
+    bool novos = true;
+    while (true) {
+        // sem valores ainda não há o que mostrar
+        if (novos && acompanha.resultado().momentos.n > 0) {
+            escreve_resultado(nome_arquivo, acompanha.resultado(), opcoes);
+            std::cout.flush();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(opcoes.intervalo));
+        novos = acompanha.atualiza();
+    }
+}
+
+//=====================================================================
+//
+// Cache binário
+//
+//=====================================================================
+
+constexpr char magica_cache[8] = {'P', '1', 'C', 'A', 'C', 'H', 'E', '\0'};
+constexpr std::uint32_t versao_cache = 2;
+
+// Caminho do cache de um arquivo de dados.
+std::string caminho_cache(const std::string &nome_arquivo) {
+    return nome_arquivo + ".cache";
+}
+
+// Tamanho e data de modificação do arquivo; false se não existir.
+bool identifica_fonte(const std::string &nome_arquivo, std::uint64_t &tamanho,
+                      std::int64_t &modificacao) {
+    std::error_code erro;
+    auto t = std::filesystem::file_size(nome_arquivo, erro);
+    if (erro) { return false; }
+    auto m = std::filesystem::last_write_time(nome_arquivo, erro);
+    if (erro) { return false; }
+    tamanho = t;
+    modificacao = static_cast<std::int64_t>(m.time_since_epoch().count());
+    return true;
+}
+
+EscritorCache::EscritorCache(const std::string &nome_arquivo)
+    : _caminho(caminho_cache(nome_arquivo)), _temporario(_caminho + ".tmp") {
+    // a identificação é feita antes de ler: se o arquivo mudar durante a
+    // leitura, o cache não vai bater na próxima vez
+    if (!identifica_fonte(nome_arquivo, _cabecalho.tamanho_fonte,
+                          _cabecalho.modificacao_fonte)) {
+        return;
+    }
+    _arquivo.open(_temporario, std::ios::binary | std::ios::trunc);
+    // reserva o espaço do cabeçalho
+    _arquivo.write(reinterpret_cast<const char *>(&_cabecalho), sizeof(_cabecalho));
+    _ok = _arquivo.good();
+}
+
+EscritorCache::~EscritorCache() {
+    // não terminado: apaga o temporário
+    if (_arquivo.is_open()) {
+        _arquivo.close();
+        std::error_code ignorado;
+        std::filesystem::remove(_temporario, ignorado);
+    }
+}
+
+void EscritorCache::adiciona(const double *valores, std::size_t n) {
+    if (!_ok) { return; }
+    _arquivo.write(reinterpret_cast<const char *>(valores), n * sizeof(double));
+    _cabecalho.n += n;
+}
+
+void EscritorCache::termina(const Momentos &momentos) {
+    if (_ok) {
+        std::memcpy(_cabecalho.magica, magica_cache, sizeof(magica_cache));
+        _cabecalho.versao = versao_cache;
+        _cabecalho.tamanho_double = sizeof(double);
+        _cabecalho.xmin = momentos.xmin;
+        _cabecalho.xmax = momentos.xmax;
+        _cabecalho.media = momentos.media;
+        _cabecalho.m2 = momentos.m2;
+        _arquivo.seekp(0);
+        _arquivo.write(reinterpret_cast<const char *>(&_cabecalho), sizeof(_cabecalho));
+        _arquivo.close();
+        std::error_code erro;
+        _ok = !_arquivo.fail();
+        if (_ok) { std::filesystem::rename(_temporario, _caminho, erro); }
+        _ok = _ok && !erro;
+    }
+    if (!_ok) {
+        std::cerr << "Aviso: não foi possível escrever " << _caminho << std::endl;
+        std::error_code ignorado;
+        std::filesystem::remove(_temporario, ignorado);
+    }
+}
+
+// Função calcula_do_cache: média, desvio e limites das caixas vêm direto do
+// cabeçalho; só a contagem das caixas passa pelos valores, que são usados
+// direto do arquivo mapeado, sem conversão de texto.
+bool calcula_do_cache(const std::string &nome_arquivo, const std::vector<int> &caixas,
+                      const Opcoes &opcoes, Resultado &resultado) {
+    auto caminho = caminho_cache(nome_arquivo);
+    std::uint64_t tamanho;
+    std::int64_t modificacao;
+    std::error_code erro;
+    if (!identifica_fonte(nome_arquivo, tamanho, modificacao) ||
+        !std::filesystem::exists(caminho, erro)) {
+        return false;
+    }
+
+    std::unique_ptr<ArquivoMapeado> mapa;
+    try {
+        mapa = std::make_unique<ArquivoMapeado>(caminho);
+    } catch (const ErroLeitura &) {
+        return false;
+    }
+    CabecalhoCache cabecalho;
+    if (mapa->tamanho() < sizeof(cabecalho)) { return false; }
+    std::memcpy(&cabecalho, mapa->dados(), sizeof(cabecalho));
+    if (std::memcmp(cabecalho.magica, magica_cache, sizeof(magica_cache)) != 0 ||
+        cabecalho.versao != versao_cache || cabecalho.tamanho_double != sizeof(double) ||
+        cabecalho.tamanho_fonte != tamanho || cabecalho.modificacao_fonte != modificacao ||
+        mapa->tamanho() != sizeof(cabecalho) + cabecalho.n * sizeof(double)) {
+        return false;
+    }
+
+    auto &momentos = resultado.momentos;
+    momentos.n = cabecalho.n;
+    momentos.media = cabecalho.media;
+    momentos.m2 = cabecalho.m2;
+    momentos.xmin = cabecalho.xmin;
+    momentos.xmax = cabecalho.xmax;
+
+    // o mapeamento começa numa página e o cabeçalho tem múltiplo de 8 bytes,
+    // então os valores estão alinhados
+    auto valores = reinterpret_cast<const double *>(mapa->dados() + sizeof(cabecalho));
+    if (opcoes.perfil != nullptr) { opcoes.perfil->bytes_lidos += mapa->tamanho(); }
+    FatiaValores fatia(valores, cabecalho.n);
+    if (opcoes.quantis) {
+        // o esboço não fica no cache: é montado dos valores mapeados
+        AcumuladorMomentos esboco(true, opcoes.n_threads);
+        esboco.push(fatia);
+        preenche_quantis(resultado, esboco.esboco());
+    }
+    AcumuladorHistogramas histogramas(momentos, caixas, opcoes.n_threads);
+    histogramas.push(fatia);
+    resultado.histogramas = histogramas.result();
+    if (!opcoes.percentis.empty()) {
+        // o mapeamento é só de leitura: a seleção trabalha numa cópia
+        std::vector<double> copia(valores, valores + cabecalho.n);
+        preenche_percentis(resultado, copia.data(), copia.size(), opcoes);
+    }
+    return true;
 }
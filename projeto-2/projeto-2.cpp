@@ -1,35 +1,661 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
 #include <cmath>
+#include <cstddef>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <new>
+#include <string>
+#include <thread>
 #include <vector>
 #include <tuple>
+#include <type_traits>
 
-class Measurement {
-    float _value;
-    float _error;
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Operadores Aritméticos
+template <class T>
+constexpr T square(T x) { return x * x; }
+
+//-----------------------------------------------------------------------------
+//
+// Expression templates for measurements.
+//
+// The arithmetic operators do not compute anything: they return a node that
+// keeps copies of its operands. When the expression is assigned to a
+// Measurement, its value and its variance (the square of the error) are
+// evaluated through the whole tree, and the error takes a single sqrt,
+// instead of one sqrt per operator that the next operator squares again.
+//
+// Everything is generic over the scalar type T (float, double or long
+// double) and constexpr, except the final sqrt.
+//
+
+enum class Operation { add, subtract, multiply, divide };
+
+// Base of every expression: a Measurement, a constant or an operation.
+template <class E>
+struct MeasurementExpr {
+  constexpr E const &self() const { return static_cast<E const &>(*this); }
+};
+
+template <class T>
+class Measurement : public MeasurementExpr<Measurement<T>> {
+    T _value;
+    T _error;
 public:
+    using value_type = T;
+
     // Construtor
-    Measurement(float value = 0, float error = 0)
+    constexpr Measurement(T value = 0, T error = 0)
         : _value(value), _error(error) {};
+    // Avalia uma expressão
+    template <class E>
+    Measurement(MeasurementExpr<E> const &expr)
+        : _value(expr.self().value()), _error(std::sqrt(expr.self().variance())) {}
     // Leitura
-    std::tuple<float, float> value_error() const {
+    constexpr std::tuple<T, T> value_error() const {
         return {_value, _error};
     }
+    constexpr T value() const { return _value; }
+    constexpr T error() const { return _error; }
+    constexpr T variance() const { return square(_error); }
+};
 
-    friend Measurement operator+(Measurement const &, Measurement const &);
-    friend Measurement operator-(Measurement const &, Measurement const &);
-    friend Measurement operator*(Measurement const &, Measurement const &);
-    friend Measurement operator/(Measurement const &, Measurement const &);
+// A number without error, like the 2 in 2*g.
+template <class T>
+class Constant : public MeasurementExpr<Constant<T>> {
+  T _value;
+public:
+  using value_type = T;
 
-    friend std::ostream &operator<<(std::ostream &, Measurement const &);
-    friend std::istream &operator>>(std::istream &, Measurement &);
+  constexpr Constant(T value) : _value(value) {}
+  constexpr T value() const { return _value; }
+  constexpr T variance() const { return 0; }
 };
 
+// a op b, with the error propagation for independent Gaussian errors.
+// Sums and differences add the variances; products and quotients add the
+// relative variances. Operations with a constant only scale the variance.
+template <Operation op, class A, class B>
+class BinaryExpr : public MeasurementExpr<BinaryExpr<op, A, B>> {
+  A _a;
+  B _b;
+public:
+  using value_type = typename A::value_type;
+
+  constexpr BinaryExpr(A const &a, B const &b) : _a(a), _b(b) {}
 
+  constexpr value_type value() const {
+    if constexpr (op == Operation::add) {
+      return _a.value() + _b.value();
+    } else if constexpr (op == Operation::subtract) {
+      return _a.value() - _b.value();
+    } else if constexpr (op == Operation::multiply) {
+      return _a.value() * _b.value();
+    } else {
+      return _a.value() / _b.value();
+    }
+  }
+
+  constexpr value_type variance() const {
+    constexpr bool constant_a = std::is_same_v<A, Constant<value_type>>;
+    constexpr bool constant_b = std::is_same_v<B, Constant<value_type>>;
+    if constexpr (op == Operation::add || op == Operation::subtract) {
+      return _a.variance() + _b.variance();
+    } else if constexpr (op == Operation::multiply && constant_a) {
+      return square(_a.value()) * _b.variance();
+    } else if constexpr (op == Operation::multiply && constant_b) {
+      return _a.variance() * square(_b.value());
+    } else if constexpr (op == Operation::divide && constant_b) {
+      return _a.variance() / square(_b.value());
+    } else {
+      return square(value()) * (_a.variance() / square(_a.value()) +
+                                _b.variance() / square(_b.value()));
+    }
+  }
+};
+
+template <class A, class B>
+constexpr BinaryExpr<Operation::add, A, B> operator+(MeasurementExpr<A> const &a, MeasurementExpr<B> const &b) {
+  return {a.self(), b.self()};
+}
+template <class A, class B>
+constexpr BinaryExpr<Operation::subtract, A, B> operator-(MeasurementExpr<A> const &a, MeasurementExpr<B> const &b) {
+  return {a.self(), b.self()};
+}
+template <class A, class B>
+constexpr BinaryExpr<Operation::multiply, A, B> operator*(MeasurementExpr<A> const &a, MeasurementExpr<B> const &b) {
+  return {a.self(), b.self()};
+}
+template <class A, class B>
+constexpr BinaryExpr<Operation::divide, A, B> operator/(MeasurementExpr<A> const &a, MeasurementExpr<B> const &b) {
+  return {a.self(), b.self()};
+}
+
+// Operations with plain numbers, converted to the scalar type of the
+// expression (so 2.0f*g also works when g is a double measurement).
+template <class A, class T = typename A::value_type>
+constexpr BinaryExpr<Operation::add, A, Constant<T>> operator+(MeasurementExpr<A> const &a, typename A::value_type b) {
+  return {a.self(), b};
+}
+template <class A, class T = typename A::value_type>
+constexpr BinaryExpr<Operation::subtract, A, Constant<T>> operator-(MeasurementExpr<A> const &a, typename A::value_type b) {
+  return {a.self(), b};
+}
+template <class A, class T = typename A::value_type>
+constexpr BinaryExpr<Operation::multiply, A, Constant<T>> operator*(MeasurementExpr<A> const &a, typename A::value_type b) {
+  return {a.self(), b};
+}
+template <class A, class T = typename A::value_type>
+constexpr BinaryExpr<Operation::divide, A, Constant<T>> operator/(MeasurementExpr<A> const &a, typename A::value_type b) {
+  return {a.self(), b};
+}
+template <class B, class T = typename B::value_type>
+constexpr BinaryExpr<Operation::add, Constant<T>, B> operator+(typename B::value_type a, MeasurementExpr<B> const &b) {
+  return {a, b.self()};
+}
+template <class B, class T = typename B::value_type>
+constexpr BinaryExpr<Operation::subtract, Constant<T>, B> operator-(typename B::value_type a, MeasurementExpr<B> const &b) {
+  return {a, b.self()};
+}
+template <class B, class T = typename B::value_type>
+constexpr BinaryExpr<Operation::multiply, Constant<T>, B> operator*(typename B::value_type a, MeasurementExpr<B> const &b) {
+  return {a, b.self()};
+}
+template <class B, class T = typename B::value_type>
+constexpr BinaryExpr<Operation::divide, Constant<T>, B> operator/(typename B::value_type a, MeasurementExpr<B> const &b) {
+  return {a, b.self()};
+}
+
+// Expressions of constants are evaluated by the compiler.
+static_assert((2.0f*Measurement<float>{3.0f, 0.5f}).value() == 6.0f);
+static_assert((2.0f*Measurement<float>{3.0f, 0.5f}).variance() == 1.0f);
+
+template <class T>
+std::ostream &operator<<(std::ostream &, Measurement<T> const &);
+template <class T>
+std::istream &operator>>(std::istream &, Measurement<T> &);
+
+
+template <class T>
 struct ParticlePosition {
-  Measurement time;   // Time
-  Measurement height; // Associated height
+  Measurement<T> time;   // Time
+  Measurement<T> height; // Associated height
+};
+
+//-----------------------------------------------------------------------------
+//
+// Correlated error propagation.
+//
+// The operators of Measurement take their operands as independent, which is
+// wrong when the same input appears more than once, as t0, t1, h0... do in
+// compute_g. A Correlated value carries instead its derivatives with respect
+// to the inputs (forward mode), and the error comes out exact to first order:
+//
+// error^2 = sum over the inputs i of (df/dx_i * error_i)^2
+//
+// The derivatives are a sparse list of (input, derivative) pairs, sorted by
+// input, stored one list after the other in a GradientArena. A computation
+// takes a mark() and release()s everything after it when done, so after the
+// first iterations a loop runs without allocating memory.
+//
+
+template <class T>
+struct Partial {
+  size_t input;
+  T derivative;
+};
+
+template <class T> class GradientArena;
+
+template <class T>
+class Correlated {
+  T _value;
+  GradientArena<T> *_arena;
+  size_t _first; // position of the derivatives in the arena
+  size_t _count; // number of inputs it depends on
+  friend class GradientArena<T>;
+public:
+  Correlated(T value, GradientArena<T> *arena, size_t first, size_t count)
+      : _value(value), _arena(arena), _first(first), _count(count) {}
+
+  T value() const { return _value; }
+
+  friend Correlated operator+(Correlated const &a, Correlated const &b) {
+    return a._arena->combine(a._value + b._value, a, 1, b, 1);
+  }
+  friend Correlated operator-(Correlated const &a, Correlated const &b) {
+    return a._arena->combine(a._value - b._value, a, 1, b, -1);
+  }
+  friend Correlated operator*(Correlated const &a, Correlated const &b) {
+    return a._arena->combine(a._value * b._value, a, b._value, b, a._value);
+  }
+  friend Correlated operator/(Correlated const &a, Correlated const &b) {
+    return a._arena->combine(a._value / b._value, a, 1 / b._value, b,
+                             -a._value / square(b._value));
+  }
+
+  // Operations with plain numbers. Adding a number does not change the
+  // derivatives, so the list is shared instead of copied.
+  friend Correlated operator+(Correlated const &a, T b) {
+    return {a._value + b, a._arena, a._first, a._count};
+  }
+  friend Correlated operator+(T a, Correlated const &b) { return b + a; }
+  friend Correlated operator-(Correlated const &a, T b) {
+    return {a._value - b, a._arena, a._first, a._count};
+  }
+  friend Correlated operator-(T a, Correlated const &b) {
+    return b._arena->scale(a - b._value, b, -1);
+  }
+  friend Correlated operator*(Correlated const &a, T b) {
+    return a._arena->scale(a._value * b, a, b);
+  }
+  friend Correlated operator*(T a, Correlated const &b) { return b * a; }
+  friend Correlated operator/(Correlated const &a, T b) {
+    return a._arena->scale(a._value / b, a, 1 / b);
+  }
+  friend Correlated operator/(T a, Correlated const &b) {
+    return b._arena->scale(a / b._value, b, -a / square(b._value));
+  }
+};
+
+template <class T>
+class GradientArena {
+  std::vector<Partial<T>> _partials;
+  std::vector<T> _errors; // error of each input
+public:
+  explicit GradientArena(size_t n_inputs) : _errors(n_inputs) {}
+
+  // The input number id, with the value and error of m.
+  Correlated<T> input(size_t id, Measurement<T> const &m) {
+    _errors[id] = m.error();
+    _partials.push_back({id, 1});
+    return {m.value(), this, _partials.size() - 1, 1};
+  }
+
+  size_t mark() const { return _partials.size(); }
+  // Frees the derivatives of every value created after mark().
+  void release(size_t mark) { _partials.resize(mark); }
+
+  Measurement<T> measurement(Correlated<T> const &x) const {
+    T variance = 0;
+    for (size_t k = x._first; k < x._first + x._count; ++k) {
+      variance += square(_partials[k].derivative * _errors[_partials[k].input]);
+    }
+    return {x._value, std::sqrt(variance)};
+  }
+
+  // Value with derivatives da*a' + db*b' (chain rule).
+  Correlated<T> combine(T value, Correlated<T> const &a, T da, Correlated<T> const &b, T db) {
+    auto first = _partials.size();
+    _partials.resize(first + a._count + b._count);
+    auto *pa = _partials.data() + a._first, *end_a = pa + a._count;
+    auto *pb = _partials.data() + b._first, *end_b = pb + b._count;
+    auto *out = _partials.data() + first;
+    // merge of the two lists, sorted by input
+    while (pa != end_a && pb != end_b) {
+      if (pa->input < pb->input) {
+        *out++ = {pa->input, da * pa->derivative};
+        ++pa;
+      } else if (pb->input < pa->input) {
+        *out++ = {pb->input, db * pb->derivative};
+        ++pb;
+      } else {
+        *out++ = {pa->input, da * pa->derivative + db * pb->derivative};
+        ++pa;
+        ++pb;
+      }
+    }
+    for (; pa != end_a; ++pa) { *out++ = {pa->input, da * pa->derivative}; }
+    for (; pb != end_b; ++pb) { *out++ = {pb->input, db * pb->derivative}; }
+    auto count = static_cast<size_t>(out - (_partials.data() + first));
+    _partials.resize(first + count);
+    return {value, this, first, count};
+  }
+
+  // Value with derivatives da*a'.
+  Correlated<T> scale(T value, Correlated<T> const &a, T da) {
+    auto first = _partials.size();
+    _partials.resize(first + a._count);
+    for (size_t k = 0; k < a._count; ++k) {
+      auto const &partial = _partials[a._first + k];
+      _partials[first + k] = {partial.input, da * partial.derivative};
+    }
+    return {value, this, first, a._count};
+  }
+};
+
+//-----------------------------------------------------------------------------
+//
+// Weighted least-squares fit of g.
+//
+// Fits h(t) = a + b t + c t^2 to all the points and g = -2c. The fit only
+// needs the sums of the normal equations, accumulated in a single pass with
+// constant memory. Accumulators of different parts of the trajectory merge by
+// adding their sums, so the parts can be fitted in parallel.
+//
+// Each point is weighted by 1/(effective variance), where
+//
+// effective variance = error_h^2 + (dh/dt)^2 error_t^2
+//
+// so the errors of the times enter g's error too. The slope dh/dt = b + 2c t
+// comes from a first estimate of b and c (a Guess), given beforehand so that
+// the fit still takes a single pass. When the chi^2 per degree of freedom is
+// larger than 1, the variance of g is also multiplied by it.
+//
+// Times and heights are taken relative to an origin (the first point of the
+// trajectory), which keeps the sums of t^4 and h^2 well conditioned.
+//
+
+template <class T>
+class QuadraticFit {
+  // the sums are in double precision at least, also for float data
+  using Sum = std::common_type_t<T, double>;
+public:
+  // First estimate of b and c, relative to the origin, for the weights.
+  struct Guess {
+    Sum b{0}, c{0};
+  };
+private:
+  Sum _t0, _h0;   // origin
+  Guess _guess;   // for the weights
+  Sum _w[5]{};    // sums of w t^k, k = 0..4
+  Sum _wh[3]{};   // sums of w h t^k, k = 0..2
+  Sum _whh{0};    // sum of w h^2
+  size_t _n{0};
+public:
+  explicit QuadraticFit(ParticlePosition<T> const &origin = {}, Guess guess = {})
+      : _t0(origin.time.value()), _h0(origin.height.value()), _guess(guess) {}
+
+  // The parabola through three points, relative to the time of p0.
+  static Guess guess_through(ParticlePosition<T> const &p0, ParticlePosition<T> const &p1,
+                             ParticlePosition<T> const &p2) {
+    Sum u1 = p1.time.value() - p0.time.value();
+    Sum u2 = p2.time.value() - p0.time.value();
+    Sum d1 = (p1.height.value() - p0.height.value()) / u1;
+    Sum d2 = (p2.height.value() - p0.height.value()) / u2;
+    Sum c = (d2 - d1) / (u2 - u1);
+    return {d1 - c * u1, c};
+  }
+
+  // The b and c of this fit, relative to a new origin at time.
+  Guess guess_at(T time) const {
+    auto fit = solve();
+    return {fit.b + 2 * fit.c * (time - _t0), fit.c};
+  }
+
+  size_t size() const { return _n; }
+
+  void push(ParticlePosition<T> const &p) { add(p, 1); }
+  // Removes a point added before.
+  void pop(ParticlePosition<T> const &p) { add(p, -1); }
+
+  // Adds the points of other, which must have the same origin and guess.
+  void merge(QuadraticFit const &other) {
+    for (int k = 0; k < 5; ++k) { _w[k] += other._w[k]; }
+    for (int k = 0; k < 3; ++k) { _wh[k] += other._wh[k]; }
+    _whh += other._whh;
+    _n += other._n;
+  }
+
+  // g = -2c.
+  Measurement<T> result() const {
+    auto fit = solve();
+    return {T(-2 * fit.c), T(2 * std::sqrt(fit.cov_cc))};
+  }
+
+  // The velocity dh/dt = b + 2c t at time t.
+  Measurement<T> velocity(T time) const {
+    auto fit = solve();
+    Sum t = time - _t0;
+    Sum variance = fit.cov_bb + 4 * t * fit.cov_bc + 4 * t * t * fit.cov_cc;
+    return {T(fit.b + 2 * fit.c * t), T(std::sqrt(variance))};
+  }
+
+private:
+  // Coefficients of the fit and the covariances of b and c.
+  struct Solution {
+    Sum a, b, c;
+    Sum cov_bb, cov_bc, cov_cc;
+  };
+
+  void add(ParticlePosition<T> const &p, int sign) {
+    Sum t = p.time.value() - _t0;
+    Sum h = p.height.value() - _h0;
+    Sum slope = _guess.b + 2 * _guess.c * t;
+    Sum w = sign / (Sum(p.height.variance()) + slope * slope * Sum(p.time.variance()));
+    Sum wt = w;
+    for (int k = 0; k < 5; ++k) {
+      _w[k] += wt;
+      if (k < 3) { _wh[k] += wt * h; }
+      wt *= t;
+    }
+    _whh += w * h * h;
+    _n += sign;
+  }
+
+  Solution solve() const {
+    // Inverse of the (symmetric) matrix of the normal equations by cofactors.
+    auto const &s = _w;
+    Sum c00 = s[2] * s[4] - s[3] * s[3];
+    Sum c01 = s[2] * s[3] - s[1] * s[4];
+    Sum c02 = s[1] * s[3] - s[2] * s[2];
+    Sum c11 = s[0] * s[4] - s[2] * s[2];
+    Sum c12 = s[1] * s[2] - s[0] * s[3];
+    Sum c22 = s[0] * s[2] - s[1] * s[1];
+    Sum det = s[0] * c00 + s[1] * c01 + s[2] * c02;
+
+    Solution fit;
+    fit.a = (c00 * _wh[0] + c01 * _wh[1] + c02 * _wh[2]) / det;
+    fit.b = (c01 * _wh[0] + c11 * _wh[1] + c12 * _wh[2]) / det;
+    fit.c = (c02 * _wh[0] + c12 * _wh[1] + c22 * _wh[2]) / det;
+
+    // chi^2 = sum w (h - a - b t - c t^2)^2, from the same sums
+    Sum scale = 1;
+    if (_n > 3) {
+      Sum chi2 = _whh - (fit.a * _wh[0] + fit.b * _wh[1] + fit.c * _wh[2]);
+      scale = std::max(Sum(1), chi2 / Sum(_n - 3));
+    }
+    fit.cov_bb = scale * c11 / det;
+    fit.cov_bc = scale * c12 / det;
+    fit.cov_cc = scale * c22 / det;
+    return fit;
+  }
+};
+
+//-----------------------------------------------------------------------------
+//
+// Sliding-window estimates of g and of the velocity.
+//
+// The quadratic fit above over the last points of the trajectory: each new
+// point is added to the sums and the oldest one is subtracted, O(1) per
+// point. The velocity is the one of the fit at the middle point of the
+// window. So that the rounding errors of the subtractions do not
+// accumulate, and to keep the origin near the window, the sums are rebuilt
+// from the window once every window-size points (O(1) per point on average).
+// A removed point must get the weight it was added with, so the guess of the
+// slope changes only at the rebuilds: the first one is the parabola through
+// the first, second and last points of the window, and each rebuild takes
+// the b and c of the current fit.
+//
+
+template <class T>
+class WindowedFit {
+  std::vector<ParticlePosition<T>> _window; // circular buffer
+  size_t _size;
+  size_t _oldest{0};
+  size_t _since_rebuild{0};
+  QuadraticFit<T> _fit;
+public:
+  // The buffer grows as the points arrive, so a window larger than the file
+  // takes only the memory of the file.
+  explicit WindowedFit(size_t size) : _size(size) {}
+
+  // Adds p, dropping the oldest point when the window is full. Returns true
+  // when the window is full, and the estimates are available.
+  bool push(ParticlePosition<T> const &p) {
+    if (_window.size() < _size) {
+      _window.push_back(p);
+      if (_window.size() < _size) { return false; }
+      rebuild(QuadraticFit<T>::guess_through(_window[0], _window[1], _window[_size - 1]));
+      return true;
+    }
+    _fit.pop(_window[_oldest]);
+    _window[_oldest] = p;
+    _oldest = (_oldest + 1) % _size;
+    _fit.push(p);
+    if (++_since_rebuild == _size) {
+      rebuild(_fit.guess_at(_window[_oldest].time.value()));
+    }
+    return true;
+  }
+
+  // Time of the middle point of the window.
+  Measurement<T> time() const { return _window[(_oldest + _size / 2) % _size].time; }
+  Measurement<T> g() const { return _fit.result(); }
+  Measurement<T> velocity() const { return _fit.velocity(time().value()); }
+
+private:
+  // Sums of the window from scratch, with the origin at its oldest point.
+  void rebuild(typename QuadraticFit<T>::Guess guess) {
+    _since_rebuild = 0;
+    _fit = QuadraticFit<T>(_window[_oldest], guess);
+    for (size_t k = 0; k < _size; ++k) {
+      _fit.push(_window[(_oldest + k) % _size]);
+    }
+  }
+};
+
+//-----------------------------------------------------------------------------
+//
+// Arrays of measurements.
+//
+// Values and errors are kept in separate columns (structure of arrays), so the
+// velocities are computed over whole columns with SIMD instructions, four
+// float or two double measurements at a time.
+//
+
+// SIMD registers for the vectorized loops. Types without a specialization
+// (long double) use only the scalar loop.
+template <class T>
+struct Lanes {
+  static constexpr size_t width = 1;
+};
+
+#ifdef __SSE2__
+template <>
+struct Lanes<float> {
+  using Register = __m128;
+  static constexpr size_t width = 4;
+  static Register load(const float *p) { return _mm_loadu_ps(p); }
+  static Register broadcast(float x) { return _mm_set1_ps(x); }
+  static void store(float *p, Register x) { _mm_storeu_ps(p, x); }
+  static Register add(Register a, Register b) { return _mm_add_ps(a, b); }
+  static Register sub(Register a, Register b) { return _mm_sub_ps(a, b); }
+  static Register mul(Register a, Register b) { return _mm_mul_ps(a, b); }
+  static Register div(Register a, Register b) { return _mm_div_ps(a, b); }
+  static Register sqrt(Register x) { return _mm_sqrt_ps(x); }
+};
+
+template <>
+struct Lanes<double> {
+  using Register = __m128d;
+  static constexpr size_t width = 2;
+  static Register load(const double *p) { return _mm_loadu_pd(p); }
+  static Register broadcast(double x) { return _mm_set1_pd(x); }
+  static void store(double *p, Register x) { _mm_storeu_pd(p, x); }
+  static Register add(Register a, Register b) { return _mm_add_pd(a, b); }
+  static Register sub(Register a, Register b) { return _mm_sub_pd(a, b); }
+  static Register mul(Register a, Register b) { return _mm_mul_pd(a, b); }
+  static Register div(Register a, Register b) { return _mm_div_pd(a, b); }
+  static Register sqrt(Register x) { return _mm_sqrt_pd(x); }
+};
+#endif
+
+// Allocator of memory aligned to cache lines. Threads writing consecutive
+// chunks of an array (of whole cache lines) then never share a line.
+constexpr size_t cache_line = 64;
+
+template <class T>
+struct CacheAlignedAllocator {
+  using value_type = T;
+
+  CacheAlignedAllocator() = default;
+  template <class U>
+  CacheAlignedAllocator(CacheAlignedAllocator<U> const &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(cache_line)));
+  }
+  void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(cache_line)); }
+
+  template <class U>
+  bool operator==(CacheAlignedAllocator<U> const &) const { return true; }
+  template <class U>
+  bool operator!=(CacheAlignedAllocator<U> const &) const { return false; }
+};
+
+// Read-only window over the columns of a MeasurementArray.
+template <class T>
+struct MeasurementView {
+  const T *values;
+  const T *errors;
+  size_t size;
+
+  MeasurementView(const T *values, const T *errors, size_t size)
+      : values(values), errors(errors), size(size) {}
+
+  Measurement<T> operator[](size_t i) const { return {values[i], errors[i]}; }
+};
+
+template <class T>
+class MeasurementArray {
+  std::vector<T, CacheAlignedAllocator<T>> _values;
+  std::vector<T, CacheAlignedAllocator<T>> _errors;
+public:
+  explicit MeasurementArray(size_t size = 0) : _values(size), _errors(size) {}
+
+  size_t size() const { return _values.size(); }
+  Measurement<T> operator[](size_t i) const { return {_values[i], _errors[i]}; }
+  void set(size_t i, Measurement<T> const &m) {
+    std::tie(_values[i], _errors[i]) = m.value_error();
+  }
+  void push_back(Measurement<T> const &m) {
+    _values.push_back(m.value());
+    _errors.push_back(m.error());
+  }
+
+  T *values() { return _values.data(); }
+  T *errors() { return _errors.data(); }
+
+  // count elements starting at first.
+  MeasurementView<T> slice(size_t first, size_t count) const {
+    return {_values.data() + first, _errors.data() + first, count};
+  }
+};
+
+// Positions as two columns, times and heights.
+template <class T>
+struct PositionArrays {
+  MeasurementArray<T> time;
+  MeasurementArray<T> height;
+
+  size_t size() const { return time.size(); }
 };
 
 //-----------------------------------------------------------------------------
@@ -38,90 +664,351 @@ struct ParticlePosition {
 //
 
 // Some useful type synonyms.
-using Positions = std::vector<ParticlePosition>;
-using Velocities = std::vector<Measurement>;
+template <class T>
+using Positions = std::vector<ParticlePosition<T>>;
+template <class T>
+using Velocities = std::vector<Measurement<T>>;
+
+// Command line options.
+struct Options {
+  std::string filename;
+  // scalar type of the computations: float, double or long-double
+  std::string precision{"float"};
+  // propagates the errors taking into account the correlations
+  bool correlated{false};
+  // g from a least-squares fit to all the points
+  bool fit{false};
+  // number of threads (0 = all the cores)
+  unsigned n_threads{1};
+  // with more than 0, g and the velocity over a window of so many points
+  size_t window{0};
+  // computes and prints while reading, with constant memory
+  bool stream{false};
+};
 
 // Tells how to execute the code.
 void usage(std::string exename);
 
+// Reads text as a whole unsigned number, like the argument of --threads.
+// False if it is not one or does not fit in number.
+template <class N>
+bool parse_unsigned(std::string const &text, N &number);
+
+// Reads the data and evaluates and prints g and the velocities, with
+// scalar type T.
+template <class T>
+void run(Options const &options);
+
+// Prints g and the velocities (a Velocities or a MeasurementArray).
+template <class T, class V>
+void print_results(Measurement<T> const &g, V const &velocities);
+
+// Prints the time, g and the velocity of each position of a sliding window.
+template <class T>
+void print_windowed(std::string filename, size_t window);
+
 // Reads data from filename.
-Positions read_data(std::string filename);
+template <class T>
+Positions<T> read_data(std::string filename);
+
+// Converts the text of a data file into positions with std::from_chars.
+// Each position is a time and a height, and each measurement is written as
+// "value error" or as "value +- error" (the format of operator<<). The text
+// can come in pieces (feed); the line and column of the text read are kept
+// for the error messages.
+class PositionParser {
+  const char *_begin{nullptr}, *_cursor{nullptr}, *_end{nullptr};
+  size_t _base{0};       // offset of _begin in the file
+  bool _last{true};      // whether _end is the end of the file
+  size_t _line{1};
+  size_t _line_start{0}; // offset of the start of the line in the file
+  std::string _error;
+public:
+  enum class Status { position, end, more, error };
+
+  // Text [begin, end), at offset base of the file.
+  void feed(const char *begin, const char *end, size_t base, bool last);
+  // Offset in the file of the text not yet converted.
+  size_t offset() const { return _base + (_cursor - _begin); }
+
+  // Converts the next position. With more, the position continues after the
+  // text fed, which must be fed again with what follows it, from offset().
+  template <class T>
+  Status next(ParticlePosition<T> &position);
+
+  // "line L, column C: what was wrong", after an error.
+  std::string const &error() const { return _error; }
+
+private:
+  void skip_blanks();
+  template <class T>
+  Status number(T &x);
+  template <class T>
+  Status measurement(Measurement<T> &m);
+  Status fail(std::string what);
+};
+
+// Read-only memory map of a whole file.
+class MappedFile {
+  const char *_data{nullptr};
+  size_t _size{0};
+#ifdef _WIN32
+  HANDLE _file{INVALID_HANDLE_VALUE};
+  HANDLE _mapping{nullptr};
+#endif
+public:
+  // Exits with 2 if filename cannot be read.
+  explicit MappedFile(std::string filename);
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+  ~MappedFile();
+
+  const char *data() const { return _data; }
+  size_t size() const { return _size; }
+};
+
+// Reads the positions of a file one at a time, a block of the file at a
+// time, so that the memory does not depend on the size of the file.
+template <class T>
+class PositionReader {
+  std::string _filename;
+  std::ifstream _datafile;
+  std::vector<char> _buffer;
+  size_t _filled{0};   // bytes of the buffer with text
+  size_t _base{0};     // offset in the file of the buffer
+  PositionParser _parser;
+public:
+  static constexpr size_t block_size = 1 << 16;
+
+  explicit PositionReader(std::string filename);
+  // Reads the next position; false at the end of the file.
+  bool next(ParticlePosition<T> &position);
+};
+
+// Prints the error of parser and exits with 3.
+[[noreturn]] void data_error(std::string const &filename, PositionParser const &parser);
+
+// Reads only the last position of filename, from the end of the file.
+template <class T>
+ParticlePosition<T> read_last_position(std::string filename);
+
+// Start in text of the count-th number from the end, or npos if text has
+// fewer numbers. Numbers are separated by blanks or by the +- between a
+// value and its error, as PositionParser reads them.
+size_t start_of_last_numbers(std::string const &text, size_t count);
+
+// Reads, computes and prints the velocities while reading the file, with a
+// buffer of velocity_chunk positions: the memory does not depend on the size
+// of the file. g comes from the first two positions and the last one (read
+// from the end of the file), or, with --fit, from a first pass over the file.
+template <class T>
+void stream_results(Options const &options);
 
 // Computes the value of g given the time and height data.
-Measurement compute_g(Positions data);
+template <class T>
+Measurement<T> compute_g(Positions<T> const &data);
+
+// Same, with the errors from the derivatives with respect to the inputs
+// (time of point i is input 2i, height is input 2i+1).
+template <class T>
+Correlated<T> compute_g(Positions<T> const &data, GradientArena<T> &arena);
+
+// The formula of g, for any measurement type.
+template <class M>
+auto g_formula(M const &t0, M const &t1, M const &tn, M const &h0, M const &h1, M const &hn);
 
 // Compute velocities in each instant given the data and
 // already evaluated g.
-Velocities compute_velocities(Positions data, Measurement g);
+template <class T>
+Velocities<T> compute_velocities(Positions<T> const &data, Measurement<T> g);
+
+// Same, over position columns, vectorized, a chunk of velocity_chunk points
+// at a time. The threads take parallel_block points
+// at a time (whole cache lines); each velocity depends only on its points, so
+// the result is the same for any number of threads.
+constexpr size_t velocity_chunk = 1024;
+constexpr size_t parallel_block = 64 * velocity_chunk;
+template <class T>
+MeasurementArray<T> compute_velocities(PositionArrays<T> const &data, Measurement<T> g,
+                                       unsigned n_threads = 1);
+
+// Writes the velocities of the count points starting at first (each one uses
+// the next point too) into velocities, starting at position at. Each
+// velocity is evaluated as one expression, vectorized.
+template <class T>
+void velocity_chunk_of(PositionArrays<T> const &data, size_t first, size_t count,
+                       Measurement<T> const &g, MeasurementArray<T> &velocities, size_t at);
+
+// Velocities with the errors from the derivatives with respect to the inputs,
+// including the inputs of g.
+template <class T>
+Velocities<T> compute_velocities(Positions<T> const &data, Correlated<T> const &g,
+                                 GradientArena<T> &arena);
+
+// Copies the positions into columns.
+template <class T>
+PositionArrays<T> to_arrays(Positions<T> const &data);
+
+// Computes g with a least-squares fit to all the points, fit_block points at
+// a time, merged in order (so the result does not depend on n_threads).
+constexpr size_t fit_block = 65536;
+template <class T>
+Measurement<T> fit_g(Positions<T> const &data, unsigned n_threads);
+
+// Runs task(0), ..., task(n_tasks - 1) in n_threads threads (0 = all the
+// cores); each thread takes the next task not yet taken.
+template <class F>
+void parallel_for(size_t n_tasks, unsigned n_threads, F const &task);
 
 
 // main
 
 int main(int argc, char const *argv[]) {
-  // We need an argument with the name of the data file.
-  if (argc != 2) {
+  // We need an argument with the name of the data file, and possibly the
+  // precision of the computations.
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--precision" && i + 1 < argc) {
+      options.precision = argv[++i];
+    } else if (arg == "--correlated") {
+      options.correlated = true;
+    } else if (arg == "--fit") {
+      options.fit = true;
+    } else if (arg == "--stream") {
+      options.stream = true;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      if (!parse_unsigned(argv[++i], options.n_threads)) {
+        usage(argv[0]);
+        std::exit(1);
+      }
+    } else if (arg == "--window" && i + 1 < argc) {
+      // a quadratic needs 3 points
+      if (!parse_unsigned(argv[++i], options.window) || options.window < 3) {
+        usage(argv[0]);
+        std::exit(1);
+      }
+    } else if (options.filename.empty() && arg.rfind("--", 0) != 0) {
+      options.filename = arg;
+    } else {
+      usage(argv[0]);
+      std::exit(1);
+    }
+  }
+  // the correlations of a fit (and of a stream) would need the derivatives
+  // with respect to every point
+  if (options.filename.empty() || (options.fit && options.correlated) ||
+      (options.window > 0 && (options.fit || options.correlated)) ||
+      (options.stream && options.correlated)) {
     usage(argv[0]);
     std::exit(1);
   }
 
-  auto data = read_data(argv[1]);
-
-  auto g = compute_g(data);
-
-  auto velocities = compute_velocities(data, g);
-
-  std::cout << "Evaluated values follow.\n\n";
-  std::cout << "Gravitational acceleration: " << g << std::endl;
-  std::cout << "Velocities:\n";
-  for (size_t i = 0; i < velocities.size(); ++i) {
-    std::cout << velocities[i] << std::endl;
+  if (options.precision == "float") {
+    run<float>(options);
+  } else if (options.precision == "double") {
+    run<double>(options);
+  } else if (options.precision == "long-double") {
+    run<long double>(options);
+  } else {
+    usage(argv[0]);
+    std::exit(1);
   }
 
   return 0;
 }
 
 
+template <class N>
+bool parse_unsigned(std::string const &text, N &number) {
+  auto end = text.data() + text.size();
+  auto [next, ec] = std::from_chars(text.data(), end, number);
+  return ec == std::errc() && next == end;
+}
+
 void usage(std::string exename) {
-  std::cerr << "Usage: " << exename << " <data file name>\n";
+  std::cerr << "Usage: " << exename << " [options] <data file name>\n"
+            << "  --precision P  scalar type of the computations: float (default),\n"
+            << "                 double or long-double\n"
+            << "  --correlated   propagates the errors taking into account that the\n"
+            << "                 same measurement appears in several operations\n"
+            << "  --fit          g from a weighted least-squares fit to all the points\n"
+            << "                 (not with --correlated)\n"
+            << "  --threads N    uses N threads (0 = all the cores)\n"
+            << "  --window W     prints g and the velocity fitted over each window of\n"
+            << "                 W points (at least 3), instead of the global values\n"
+            << "  --stream       prints the velocities while reading the file, with\n"
+            << "                 constant memory (not with --correlated)\n";
 }
 
-// Operadores Aritméticos
-inline float square(float x) { return x * x; }
+template <class T>
+void run(Options const &options) {
+  // the windows are always computed while reading
+  if (options.window > 0) {
+    print_windowed<T>(options.filename, options.window);
+    return;
+  }
 
-Measurement operator+(Measurement const &a, Measurement const &b){
-    auto value = a._value + b._value;
-    auto error = std::sqrt(square(a._error) + square(b._error));
-    return {value, error};
-}
+  if (options.stream) {
+    stream_results<T>(options);
+    return;
+  }
+
+  auto data = read_data<T>(options.filename);
 
-Measurement operator-(Measurement const &a, Measurement const &b){
-    auto value = a._value - b._value;
-    auto error = std::sqrt(square(a._error) + square(b._error));
-    return {value, error};
+  if (options.correlated) {
+    GradientArena<T> arena(2 * data.size());
+    auto g = compute_g(data, arena);
+    auto velocities = compute_velocities(data, g, arena);
+    print_results(arena.measurement(g), velocities);
+    return;
+  }
+
+  auto g = options.fit ? fit_g(data, options.n_threads) : compute_g(data);
+
+  auto velocities = compute_velocities(to_arrays(data), g, options.n_threads);
+
+  print_results(g, velocities);
 }
 
-Measurement operator*(Measurement const &a, Measurement const &b){
-    auto value = a._value * b._value;
-    auto error = std::fabs(value) * std::sqrt(square(a._error / a._value) + square(b._error / b._value));
-    return {value, error};
+template <class T>
+void print_windowed(std::string filename, size_t window) {
+  std::cout << "Evaluated values follow.\n\n";
+  std::cout << "Time, gravitational acceleration and velocity over windows of "
+            << window << " points:\n";
+  WindowedFit<T> fit(window);
+  PositionReader<T> reader(filename);
+  ParticlePosition<T> position;
+  while (reader.next(position)) {
+    if (fit.push(position)) {
+      std::cout << fit.time() << ", " << fit.g() << ", " << fit.velocity() << '\n';
+    }
+  }
+  std::cout << std::flush;
 }
 
-Measurement operator/(Measurement const &a, Measurement const &b){
-    auto value = a._value / b._value;
-    auto error = std::fabs(value) * std::sqrt(square(a._error / a._value) + square(b._error / b._value));
-    return {value, error};
+template <class T, class V>
+void print_results(Measurement<T> const &g, V const &velocities) {
+  std::cout << "Evaluated values follow.\n\n";
+  std::cout << "Gravitational acceleration: " << g << std::endl;
+  std::cout << "Velocities:\n";
+  for (size_t i = 0; i < velocities.size(); ++i) {
+    std::cout << velocities[i] << std::endl;
+  }
 }
 
 // Operador de inserção
-std::ostream &operator<<(std::ostream &os, Measurement const &a) {
+template <class T>
+std::ostream &operator<<(std::ostream &os, Measurement<T> const &a) {
   // Escrevemos no formato value +- error
-  os << a._value << " +- " << a._error;
+  os << a.value() << " +- " << a.error();
   return os;
 }
 
 // Operador de extração
-std::istream &operator>>(std::istream &is, Measurement &m) {
-    float v, e;
+template <class T>
+std::istream &operator>>(std::istream &is, Measurement<T> &m) {
+    T v, e;
     char sep;
 
     is >> v;
@@ -147,51 +1034,368 @@ std::istream &operator>>(std::istream &is, Measurement &m) {
     if (!is.good())
         return is;
 
-    m = Measurement{v, e};
+    m = Measurement<T>{v, e};
     return is;
 }
 
-Positions read_data(std::string filename) {
+template <class T>
+Positions<T> read_data(std::string filename) {
 
-    Positions data;
+    Positions<T> data;
 
-    std::ifstream datafile(filename);
-    if (!datafile.good()) {
+    // The whole file is mapped in memory and converted at once.
+    MappedFile file(filename);
+    PositionParser parser;
+    parser.feed(file.data(), file.data() + file.size(), 0, true);
+    ParticlePosition<T> position;
+    for (;;) {
+        auto status = parser.next(position);
+        if (status == PositionParser::Status::end) {
+            break;
+        }
+        if (status != PositionParser::Status::position) {
+            data_error(filename, parser);
+        }
+        data.push_back(position);
+    }
+
+    return data;
+}
+
+void data_error(std::string const &filename, PositionParser const &parser) {
+    std::cerr << "Error reading data from " << filename << ": " << parser.error() << std::endl;
+    std::exit(3);
+}
+
+void PositionParser::feed(const char *begin, const char *end, size_t base, bool last) {
+    _begin = _cursor = begin;
+    _end = end;
+    _base = base;
+    _last = last;
+}
+
+void PositionParser::skip_blanks() {
+    for (; _cursor != _end; ++_cursor) {
+        char c = *_cursor;
+        if (c == '\n') {
+            ++_line;
+            _line_start = offset() + 1;
+        } else if (c != ' ' && c != '\t' && c != '\r' && c != '\v' && c != '\f') {
+            break;
+        }
+    }
+}
+
+PositionParser::Status PositionParser::fail(std::string what) {
+    _error = "line " + std::to_string(_line) + ", column " +
+             std::to_string(offset() - _line_start + 1) + ": " + what;
+    return Status::error;
+}
+
+template <class T>
+PositionParser::Status PositionParser::number(T &x) {
+    skip_blanks();
+    if (_cursor == _end) {
+        return _last ? fail("expected a number, found the end of the file") : Status::more;
+    }
+    // from_chars does not take the + sign that >> takes
+    auto start = _cursor;
+    if (*start == '+' && start + 1 != _end && start[1] != '-') {
+        ++start;
+    }
+    auto [next, ec] = std::from_chars(start, _end, x);
+    if (ec == std::errc::result_out_of_range) {
+        return fail("number out of range");
+    }
+    // the number may go on in the text not fed yet
+    if (ec == std::errc() && next == _end && !_last) {
+        return Status::more;
+    }
+    // from_chars also reads inf and nan, which are not measurements
+    if (ec != std::errc() || !std::isfinite(x)) {
+        auto token_end = std::find_if(_cursor, _end, [](char c) { return std::isspace(static_cast<unsigned char>(c)); });
+        return fail("expected a number, found '" + std::string(_cursor, token_end) + "'");
+    }
+    if (next != _end && !std::isspace(static_cast<unsigned char>(*next)) && *next != '+') {
+        _cursor = next;
+        return fail(std::string("unexpected character '") + *next + "' after a number");
+    }
+    _cursor = next;
+    return Status::position;
+}
+
+template <class T>
+PositionParser::Status PositionParser::measurement(Measurement<T> &m) {
+    T value, error;
+    auto status = number(value);
+    if (status != Status::position) {
+        return status;
+    }
+    // optional +- between the value and the error
+    skip_blanks();
+    if (_end - _cursor < 2 && !_last) {
+        return Status::more;
+    }
+    if (_end - _cursor >= 2 && _cursor[0] == '+' && _cursor[1] == '-') {
+        _cursor += 2;
+    }
+    status = number(error);
+    if (status != Status::position) {
+        return status;
+    }
+    m = Measurement<T>{value, error};
+    return Status::position;
+}
+
+template <class T>
+PositionParser::Status PositionParser::next(ParticlePosition<T> &position) {
+    skip_blanks();
+    if (_cursor == _end) {
+        return _last ? Status::end : Status::more;
+    }
+    // with more, the position is read again from its start
+    auto cursor = _cursor;
+    auto line = _line;
+    auto line_start = _line_start;
+    auto status = measurement(position.time);
+    if (status == Status::position) {
+        status = measurement(position.height);
+    }
+    if (status == Status::more) {
+        _cursor = cursor;
+        _line = line;
+        _line_start = line_start;
+    }
+    return status;
+}
+
+MappedFile::MappedFile(std::string filename) {
+#ifdef _WIN32
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER size;
+    if (_file != INVALID_HANDLE_VALUE && GetFileSizeEx(_file, &size)) {
+        _size = static_cast<size_t>(size.QuadPart);
+        _mapping = _size > 0 ? CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr)
+                             : nullptr;
+        if (_mapping != nullptr) {
+            _data = static_cast<const char *>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+    }
+    bool good = _file != INVALID_HANDLE_VALUE && (_size == 0 || _data != nullptr);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    bool good = fd >= 0 && fstat(fd, &info) == 0;
+    if (good) {
+        _size = static_cast<size_t>(info.st_size);
+        // an empty file cannot be mapped (and has no data)
+        if (_size > 0) {
+            void *p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            good = p != MAP_FAILED;
+            if (good) {
+                _data = static_cast<const char *>(p);
+                madvise(p, _size, MADV_SEQUENTIAL);
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+#endif
+    if (!good) {
         std::cerr << "Error reading " << filename << std::endl;
         std::exit(2);
     }
+}
 
-    // Read a position (time+height with errors) value.
-    float value, error;
-    // Try to read until the end of the file.
-    while (datafile >> value) {
-        // If we find a value, there must be 3 more values.
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (_data != nullptr) { UnmapViewOfFile(_data); }
+    if (_mapping != nullptr) { CloseHandle(_mapping); }
+    if (_file != INVALID_HANDLE_VALUE) { CloseHandle(_file); }
+#else
+    if (_data != nullptr) { munmap(const_cast<char *>(_data), _size); }
+#endif
+}
+
+template <class T>
+PositionReader<T>::PositionReader(std::string filename)
+    : _filename(filename), _datafile(filename, std::ios::binary), _buffer(block_size) {
+    if (!_datafile.good()) {
+        std::cerr << "Error reading " << filename << std::endl;
+        std::exit(2);
+    }
+    _parser.feed(_buffer.data(), _buffer.data(), 0, false);
+}
 
-        datafile >> error;
-        if (datafile.fail()) {
-            std::cerr << "Error reading data from " << filename << std::endl;
-            std::exit(3);
+template <class T>
+bool PositionReader<T>::next(ParticlePosition<T> &position) {
+    for (;;) {
+        switch (_parser.next(position)) {
+        case PositionParser::Status::position:
+            return true;
+        case PositionParser::Status::end:
+            return false;
+        case PositionParser::Status::error:
+            data_error(_filename, _parser);
+        case PositionParser::Status::more:
+            break;
         }
+        // Keeps the text not converted yet, at the start of the buffer, and
+        // reads the next block after it. The buffer only grows when a
+        // single position does not fit in it.
+        auto consumed = _parser.offset() - _base;
+        auto kept = _filled - consumed;
+        std::copy(_buffer.begin() + consumed, _buffer.begin() + _filled, _buffer.begin());
+        _base = _parser.offset();
+        if (kept == _buffer.size()) {
+            _buffer.resize(2 * _buffer.size());
+        }
+        _datafile.read(_buffer.data() + kept, _buffer.size() - kept);
+        _filled = kept + _datafile.gcount();
+        _parser.feed(_buffer.data(), _buffer.data() + _filled, _base, !_datafile);
+    }
+}
 
-        Measurement time{value, error};
+size_t start_of_last_numbers(std::string const &text, size_t count) {
+    auto blank = [&](size_t i) { return std::isspace(static_cast<unsigned char>(text[i])) != 0; };
+    // whether the +- of a measurement ends just before i
+    auto plus_minus = [&](size_t i) { return i >= 2 && text[i - 2] == '+' && text[i - 1] == '-'; };
+    size_t i = text.size();
+    for (size_t found = 0; found < count; ++found) {
+        // separators, then the number before them
+        while (i > 0 && (blank(i - 1) || plus_minus(i))) {
+            i -= blank(i - 1) ? 1 : 2;
+        }
+        if (i == 0) {
+            return std::string::npos;
+        }
+        while (i > 0 && !blank(i - 1) && !plus_minus(i)) {
+            --i;
+        }
+    }
+    return i;
+}
 
-        datafile >> value;
-        datafile >> error;
-        if (datafile.fail()) {
-            std::cerr << "Error reading data from " << filename << std::endl;
-            std::exit(3);
+template <class T>
+ParticlePosition<T> read_last_position(std::string filename) {
+    std::ifstream datafile(filename, std::ios::binary);
+    if (!datafile.good()) {
+        std::cerr << "Error reading " << filename << std::endl;
+        std::exit(2);
+    }
+    datafile.seekg(0, std::ios::end);
+    std::streamoff size = datafile.tellg();
+
+    // Reads a tail of the file, twice as long each time, until it has the
+    // last four numbers whole: a position may be split across lines.
+    std::string tail;
+    for (std::streamoff length = 4096;; length *= 2) {
+        length = std::min(length, size);
+        tail.resize(length);
+        datafile.seekg(size - length);
+        datafile.read(&tail[0], length);
+        auto start = start_of_last_numbers(tail, 4);
+        // a number at the start of a partial tail may have been cut
+        if ((start != std::string::npos && start > 0) || length == size) {
+            tail = start == std::string::npos ? "" : tail.substr(start);
+            break;
         }
+    }
 
-        Measurement height{value, error};
+    // (the line numbers of the messages count from the last position)
+    PositionParser parser;
+    parser.feed(tail.data(), tail.data() + tail.size(), 0, true);
+    ParticlePosition<T> position;
+    if (parser.next(position) != PositionParser::Status::position) {
+        std::cerr << "Error reading data from " << filename << ": last " << parser.error()
+                  << std::endl;
+        std::exit(3);
+    }
+    return position;
+}
 
-        data.push_back({time, height});
+template <class T>
+void stream_results(Options const &options) {
+  PositionReader<T> reader(options.filename);
+  ParticlePosition<T> first, second;
+  if (!reader.next(first) || !reader.next(second)) {
+    std::cerr << "Error reading data from " << options.filename << std::endl;
+    std::exit(3);
+  }
+
+  Measurement<T> g;
+  auto last = read_last_position<T>(options.filename);
+  if (options.fit) {
+    // Same guess and blocks, merged in the same order, as fit_g.
+    auto guess = QuadraticFit<T>::guess_through(first, second, last);
+    PositionReader<T> fit_reader(options.filename);
+    QuadraticFit<T> fit(first, guess), block(first, guess);
+    ParticlePosition<T> position;
+    for (size_t i = 0; fit_reader.next(position); ++i) {
+      if (i > 0 && i % fit_block == 0) {
+        if (i == fit_block) { fit = block; } else { fit.merge(block); }
+        block = QuadraticFit<T>(first, guess);
+      }
+      block.push(position);
     }
+    if (fit.size() == 0) { fit = block; } else { fit.merge(block); }
+    g = fit.result();
+  } else {
+    g = g_formula(first.time, second.time, last.time, first.height, second.height, last.height);
+  }
 
-    return data;
+  std::cout << "Evaluated values follow.\n\n";
+  std::cout << "Gravitational acceleration: " << g << std::endl;
+  std::cout << "Velocities:\n";
+
+  // The buffer has a chunk of positions plus the first of the next chunk,
+  // which the last velocity of the chunk needs.
+  PositionArrays<T> buffer{MeasurementArray<T>(velocity_chunk + 1),
+                           MeasurementArray<T>(velocity_chunk + 1)};
+  buffer.time.set(0, first.time);
+  buffer.height.set(0, first.height);
+  buffer.time.set(1, second.time);
+  buffer.height.set(1, second.height);
+  size_t filled = 2;
+  MeasurementArray<T> velocities(velocity_chunk);
+  // the last velocity evaluated and the time of its position
+  Measurement<T> last_velocity, last_time;
+
+  auto flush = [&](size_t count) {
+    velocity_chunk_of(buffer, 0, count, g, velocities, 0);
+    for (size_t i = 0; i < count; ++i) {
+      std::cout << velocities[i] << '\n';
+    }
+    std::cout << std::flush;
+    last_velocity = velocities[count - 1];
+    last_time = buffer.time[count - 1];
+    buffer.time.set(0, buffer.time[count]);
+    buffer.height.set(0, buffer.height[count]);
+    filled = 1;
+  };
+
+  ParticlePosition<T> position;
+  while (reader.next(position)) {
+    buffer.time.set(filled, position.time);
+    buffer.height.set(filled, position.height);
+    if (++filled == velocity_chunk + 1) {
+      flush(velocity_chunk);
+    }
+  }
+  if (filled > 1) {
+    flush(filled - 1);
+  }
+
+  // The last velocity is evaluated from the one before last and the value of g.
+  auto last_delta_t = buffer.time[0]-last_time;
+  std::cout << Measurement<T>(last_velocity-(g*last_delta_t)) << std::endl;
 }
 
 // Computes the value of g given the time and height data.
-Measurement compute_g(Positions data) {
+template <class T>
+Measurement<T> compute_g(Positions<T> const &data) {
   // Uses the first, second and last positions and corresponding times,
   // and compute
   //
@@ -207,6 +1411,24 @@ Measurement compute_g(Positions data) {
   auto h1 = data[1].height;
   auto hn = data[num_points - 1].height;
 
+  return g_formula(t0, t1, tn, h0, h1, hn);
+}
+
+template <class T>
+Correlated<T> compute_g(Positions<T> const &data, GradientArena<T> &arena) {
+  auto n = data.size() - 1;
+  auto t0 = arena.input(0, data[0].time);
+  auto t1 = arena.input(2, data[1].time);
+  auto tn = arena.input(2 * n, data[n].time);
+  auto h0 = arena.input(1, data[0].height);
+  auto h1 = arena.input(3, data[1].height);
+  auto hn = arena.input(2 * n + 1, data[n].height);
+
+  return g_formula(t0, t1, tn, h0, h1, hn);
+}
+
+template <class M>
+auto g_formula(M const &t0, M const &t1, M const &tn, M const &h0, M const &h1, M const &hn) {
   auto delta_h_10 = h1-h0;
   auto delta_h_n0 = hn-h0;
   auto delta_h_n1 = hn-h1;
@@ -223,9 +1445,10 @@ Measurement compute_g(Positions data) {
 
 // Compute velocities in each instant given the data and
 // already evaluated g.
-Velocities compute_velocities(Positions data, Measurement g) {
+template <class T>
+Velocities<T> compute_velocities(Positions<T> const &data, Measurement<T> g) {
   auto const n_data = data.size();
-  Velocities velocities(n_data);
+  Velocities<T> velocities(n_data);
 
   // For each data point (except the last, see below), evaluate the velocity as
   // the starting velocity for a free fall to reach the next point.
@@ -244,3 +1467,153 @@ Velocities compute_velocities(Positions data, Measurement g) {
 
   return velocities;
 }
+
+// Compute velocities in each instant given the data and
+// already evaluated g. Each thread writes its blocks straight into the
+// result.
+template <class T>
+MeasurementArray<T> compute_velocities(PositionArrays<T> const &data, Measurement<T> g,
+                                       unsigned n_threads) {
+  auto const n_data = data.size();
+  MeasurementArray<T> velocities(n_data);
+
+  // v = delta_h/delta_t + g*delta_t/2, for all points but the last.
+  auto const n_blocks = (n_data - 1 + parallel_block - 1) / parallel_block;
+  parallel_for(n_blocks, n_threads, [&](size_t k) {
+    auto end = std::min(n_data - 1, (k + 1) * parallel_block);
+    for (size_t first = k * parallel_block; first < end; first += velocity_chunk) {
+      auto count = std::min(velocity_chunk, end - first);
+      velocity_chunk_of(data, first, count, g, velocities, first);
+    }
+  });
+
+  // The last velocity is evaluated from the one before last and the value of g.
+  auto last_delta_t = data.time[n_data - 1]-data.time[n_data - 2];
+  velocities.set(n_data - 1, velocities[n_data - 2]-(g*last_delta_t));
+
+  return velocities;
+}
+
+// The SSE loop evaluates the tree of the scalar expression, in the same
+// order, so the results are identical to the ones of the scalar loop at the
+// end. Each velocity takes a single sqrt and nothing is allocated.
+template <class T>
+void velocity_chunk_of(PositionArrays<T> const &data, size_t first, size_t count,
+                       Measurement<T> const &g, MeasurementArray<T> &velocities, size_t at) {
+  auto time = data.time.slice(first, count + 1);
+  auto height = data.height.slice(first, count + 1);
+  T *values = velocities.values() + at;
+  T *errors = velocities.errors() + at;
+
+  size_t i = 0;
+  if constexpr (Lanes<T>::width > 1) {
+    using L = Lanes<T>;
+    auto gv = L::broadcast(g.value());
+    auto g_variance = L::broadcast(g.variance());
+    auto two = L::broadcast(2), four = L::broadcast(4);
+    for (; i + L::width <= count; i += L::width) {
+      auto h0 = L::load(height.values + i), h1 = L::load(height.values + i + 1);
+      auto eh0 = L::load(height.errors + i), eh1 = L::load(height.errors + i + 1);
+      auto t0 = L::load(time.values + i), t1 = L::load(time.values + i + 1);
+      auto et0 = L::load(time.errors + i), et1 = L::load(time.errors + i + 1);
+      // delta_h and delta_t, with their variances
+      auto dh = L::sub(h1, h0);
+      auto dh_variance = L::add(L::mul(eh1, eh1), L::mul(eh0, eh0));
+      auto dt = L::sub(t1, t0);
+      auto dt_variance = L::add(L::mul(et1, et1), L::mul(et0, et0));
+      auto dt_relative = L::div(dt_variance, L::mul(dt, dt));
+      // delta_h/delta_t and g*delta_t
+      auto q = L::div(dh, dt);
+      auto q_variance = L::mul(L::mul(q, q), L::add(L::div(dh_variance, L::mul(dh, dh)), dt_relative));
+      auto p = L::mul(gv, dt);
+      auto p_variance = L::mul(L::mul(p, p), L::add(L::div(g_variance, L::mul(gv, gv)), dt_relative));
+      // q + p/2
+      L::store(values + i, L::add(q, L::div(p, two)));
+      L::store(errors + i, L::sqrt(L::add(q_variance, L::div(p_variance, four))));
+    }
+  }
+  for (; i < count; ++i) {
+    auto delta_h = height[i + 1] - height[i];
+    auto delta_t = time[i + 1] - time[i];
+    velocities.set(at + i, Measurement<T>((delta_h/delta_t)+((g*delta_t)/T(2))));
+  }
+}
+
+template <class T>
+PositionArrays<T> to_arrays(Positions<T> const &data) {
+  PositionArrays<T> arrays{MeasurementArray<T>(data.size()), MeasurementArray<T>(data.size())};
+  for (size_t i = 0; i < data.size(); ++i) {
+    arrays.time.set(i, data[i].time);
+    arrays.height.set(i, data[i].height);
+  }
+  return arrays;
+}
+
+template <class T>
+Velocities<T> compute_velocities(Positions<T> const &data, Correlated<T> const &g,
+                                 GradientArena<T> &arena) {
+  auto const n_data = data.size();
+  Velocities<T> velocities(n_data);
+
+  // v = delta_h/delta_t + g*delta_t/2, as in the other versions.
+  auto velocity = [&](size_t i) {
+    auto delta_h = arena.input(2 * i + 3, data[i + 1].height) - arena.input(2 * i + 1, data[i].height);
+    auto delta_t = arena.input(2 * i + 2, data[i + 1].time) - arena.input(2 * i, data[i].time);
+    return (delta_h/delta_t)+((g*delta_t)/2.0f);
+  };
+
+  // The derivatives of each velocity are released once it is evaluated.
+  auto const mark = arena.mark();
+  for (size_t i = 0; i < n_data - 1; ++i) {
+    velocities[i] = arena.measurement(velocity(i));
+    arena.release(mark);
+  }
+
+  // The last velocity is evaluated from the one before last and the value of g.
+  auto last_delta_t = arena.input(2 * n_data - 2, data[n_data - 1].time) -
+                      arena.input(2 * n_data - 4, data[n_data - 2].time);
+  velocities[n_data - 1] = arena.measurement(velocity(n_data - 2)-(g*last_delta_t));
+  arena.release(mark);
+
+  return velocities;
+}
+
+template <class T>
+Measurement<T> fit_g(Positions<T> const &data, unsigned n_threads) {
+  auto const n_blocks = (data.size() + fit_block - 1) / fit_block;
+  // the weights use the slope of the parabola of compute_g
+  auto guess = QuadraticFit<T>::guess_through(data[0], data[1], data[data.size() - 1]);
+  std::vector<QuadraticFit<T>> fits(n_blocks, QuadraticFit<T>(data[0], guess));
+  parallel_for(n_blocks, n_threads, [&](size_t k) {
+    auto end = std::min(data.size(), (k + 1) * fit_block);
+    for (size_t i = k * fit_block; i < end; ++i) {
+      fits[k].push(data[i]);
+    }
+  });
+  for (size_t k = 1; k < n_blocks; ++k) {
+    fits[0].merge(fits[k]);
+  }
+  return fits[0].result();
+}
+
+template <class F>
+void parallel_for(size_t n_tasks, unsigned n_threads, F const &task) {
+  if (n_threads == 0) {
+    n_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  n_threads = static_cast<unsigned>(std::min<size_t>(n_threads, n_tasks));
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (size_t k = next++; k < n_tasks; k = next++) {
+      task(k);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned j = 1; j < n_threads; ++j) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}